@@ -0,0 +1,46 @@
+#pragma once
+
+// Support for ROMs compiled ahead of time to C by `ch8recomp`.
+// The generated file provides the ROM itself and one function per basic
+// block. chip8_aot_run calls those whenever PC sits at the start of a
+// block whose bytes haven't been written since the ROM was loaded,
+// and falls back to chip8_step for everything else (computed jumps,
+// self-modifying code, anything the recompiler couldn't find).
+
+#include "chip8.h"
+#include "decode.h"
+#include "quirks.h"
+
+typedef struct chip8_aot_block {
+  void (*fn)(chip8*); // NULL if no block starts here
+  word len;           // number of instructions
+} chip8_aot_block;
+
+// provided by the generated file
+extern const byte chip8_aot_rom[];
+extern const long chip8_aot_rom_length;
+extern const chip8_aot_block chip8_aot_blocks[CHIP8_MEM_SIZE];
+// the quirks the blocks were compiled with, pass it to chip8_set_profile
+extern const chip8_profile chip8_aot_profile;
+
+// Makes chip8_run use these blocks (usually chip8_aot_blocks).
+void chip8_aot_enable(chip8*, const chip8_aot_block *blocks);
+void chip8_aot_disable(chip8*);
+
+// Runs up to `cycles` instructions, stopping early if the machine quits
+// or an instruction sets ch8->stop.
+// Returns how many instructions were executed.
+uint32_t chip8_aot_run(chip8*, uint32_t cycles);
+
+// One instruction inside a generated block.
+// The operands are constants, so the handler inlines down to almost nothing.
+#define CHIP8_AOT_OP(handler, op, x, y, n, nn, nnn) do { \
+  static const chip8_instr in_ = { op, x, y, n, nn, nnn }; \
+  handler(ch8, &in_); \
+} while (0)
+
+// Same, for the handlers that take the profile's quirks.
+#define CHIP8_AOT_QUIRK_OP(handler, quirks, op, x, y, n, nn, nnn) do { \
+  static const chip8_instr in_ = { op, x, y, n, nn, nnn }; \
+  handler(ch8, &in_, quirks); \
+} while (0)
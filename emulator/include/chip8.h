@@ -2,16 +2,45 @@
 
 #include "typedefs.h"
 
+#include <stddef.h>
+
 #define CHIP8_MEM_SIZE 4096
+#define CHIP8_ADDR_MASK (CHIP8_MEM_SIZE - 1)
 #define CHIP8_PROGRAM_START_ADDRESS 0x200
 #define CHIP8_MAX_PROGRAM_SIZE (CHIP8_MEM_SIZE - CHIP8_PROGRAM_START_ADDRESS)
 #define CHIP8_STACK_SIZE 16
 
+// instructions per 60 Hz timer tick, see chip8_set_cycles_per_tick
+#define CHIP8_DEFAULT_CYCLES_PER_TICK 1000
+
+// what chip8_init seeds CXNN's generator with, see chip8_seed
+#define CHIP8_DEFAULT_SEED 0x43484950382D3821ull
+
 #define CHIP8_SCREEN_W 64
 #define CHIP8_SCREEN_H 32
 
+// By default addresses just wrap around at 4 KiB.
+// Build with CHIP8_CHECKED_MEMORY to stop with an error on any
+// out-of-bounds access instead, which is handy when debugging a ROM.
+
+struct chip8_cache;
+struct chip8_jit;
+struct chip8_aot_block;
+struct chip8_core;
+
+// why chip8_run returned
+typedef enum {
+  CHIP8_STOP_NONE,    // ran the whole budget
+  CHIP8_STOP_QUIT,    // BREAK, or quit was set from outside
+  CHIP8_STOP_ERROR,   // see errormsg
+  CHIP8_STOP_KEYWAIT, // FX0A is waiting for a key, PC still points at it
+  CHIP8_STOP_DRAW,    // just drew a sprite or pixel, or cleared the screen
+} chip8_stop;
+
 typedef struct {
-  byte *mem;
+  // first, so it starts on a cache line
+  _Alignas(64) byte mem[CHIP8_MEM_SIZE];
+
   byte R[16];
   word I;
   word SP;
@@ -20,7 +49,16 @@ typedef struct {
 
   byte timer, sound;
 
-  bool screen[CHIP8_SCREEN_W][CHIP8_SCREEN_H];
+  // xorshift64* state for CXNN, never 0
+  uint64_t rng;
+
+  // one row per word, leftmost pixel in the top bit
+  uint64_t screen[CHIP8_SCREEN_H];
+
+  // Rows changed since chip8_clear_dirty, bit y for row y, and whether
+  // anything changed at all. For whoever shows or records the screen.
+  uint32_t dirty_rows;
+  bool screen_changed;
 
   bool keys[16];
 
@@ -28,18 +66,102 @@ typedef struct {
   char errormsg[256]; // error message
 
   bool quit;
+
+  // handlers and run loop for the quirk profile, see chip8_set_profile
+  const struct chip8_core *core;
+
+  // set by instructions that want chip8_run to return early
+  chip8_stop stop;
+
+  // instructions executed by chip8_run so far, and the virtual clock:
+  // every cycles_per_tick of them the timers tick once
+  uint64_t cycles;
+  uint64_t ticks;
+  uint32_t cycles_per_tick;
+  uint32_t tick_cycles_left;
+
+  // how many of those cycles idle loops took without running, see idle.h
+  uint64_t idle_cycles;
+
+  // one bit per byte of memory written since the ROM was loaded
+  uint64_t written[CHIP8_MEM_SIZE / 64];
+
+  // pre-decoded instructions for chip8_threaded_run, NULL when not in use
+  struct chip8_cache *cache;
+  // translated code for chip8_jit_run, NULL when not in use
+  struct chip8_jit *jit;
+  // blocks compiled in by ch8recomp, NULL when not in use
+  const struct chip8_aot_block *aot;
 } chip8;
 
 bool chip8_init(chip8*);
 void chip8_quit(chip8*);
 
-bool chip8_loadrom(chip8*, byte *rom, long length);
+bool chip8_loadrom(chip8*, const byte *rom, long length);
+
+// Stops the machine with an error, see errormsg.
+void chip8_error(chip8*, const char *msg);
+
+// malloc and free for anything holding a chip8 or a save state, which want
+// the 64-byte alignment malloc doesn't promise. Returns NULL if out of memory.
+void *chip8_aligned_alloc(size_t size);
+void chip8_aligned_free(void*);
 
+#ifdef CHIP8_CHECKED_MEMORY
 byte chip8_read(chip8*, word addr);
+#else
+static inline byte chip8_read(chip8 *ch8, word addr) {
+  return ch8->mem[addr & CHIP8_ADDR_MASK];
+}
+#endif
 void chip8_write(chip8*, word addr, byte value);
 
 void chip8_dump_registers(chip8*);
 
+// FNV-1a over everything a program can see (registers, stack, timers,
+// random number state, memory and screen), for checking runs against each other.
+uint64_t chip8_hash(const chip8*);
+
+static inline bool chip8_get_pixel(const chip8 *ch8, int x, int y) {
+  return (ch8->screen[y] >> (CHIP8_SCREEN_W-1 - x)) & 1;
+}
+
+static inline void chip8_clear_dirty(chip8 *ch8) {
+  ch8->dirty_rows = 0;
+  ch8->screen_changed = false;
+}
+
+// Restarts CXNN's random numbers. The same seed always gives the same
+// numbers, on any machine, so runs can be repeated exactly.
+void chip8_seed(chip8*, uint64_t seed);
+
+// The next random byte, every value from 0 to 255 equally likely
+static inline byte chip8_random(chip8 *ch8) {
+  ch8->rng ^= ch8->rng >> 12;
+  ch8->rng ^= ch8->rng << 25;
+  ch8->rng ^= ch8->rng >> 27;
+  return (ch8->rng * 0x2545F4914F6CDD1Dull) >> 56;
+}
+
 void chip8_step(chip8*);
 
+// Runs up to max_cycles instructions on the fastest backend that's enabled
+// (compiled-in blocks, then the recompiler, then the threaded interpreter,
+// then plain chip8_step). Returns early on quit, error, a key wait or a draw.
+// Ticks the timers as it goes, so the result only depends on the cycles run.
+// Waiting for a key counts as running the rest of max_cycles, like FX0A
+// spinning on the real thing, so the timers keep going meanwhile.
+chip8_stop chip8_run(chip8*, uint32_t max_cycles);
+
+// How fast the virtual clock goes, at least 1.
+void chip8_set_cycles_per_tick(chip8*, uint32_t cycles_per_tick);
+
+// Instructions until the timers next tick. Run this many to finish a frame.
+static inline uint32_t chip8_cycles_until_tick(const chip8 *ch8) {
+  return ch8->tick_cycles_left;
+}
+
+// Runs until the timers next tick, one 60 Hz frame, or the machine quits.
+void chip8_run_frame(chip8*);
+
 void chip8_timer_tick(chip8*);
@@ -0,0 +1,147 @@
+// One specialized core, stamped out once per profile by cores.c:
+//
+//   #define CORE_NAME chip8_cosmac_
+//   #define CORE_QUIRKS CHIP8_QUIRKS_COSMAC
+//   #include "core.h"
+//
+// which defines chip8_cosmac_handlers and chip8_cosmac_run.
+// Nothing else should include this.
+
+#include "ops.h"
+#include "idle.h"
+
+#define CORE_CAT_(a, b) a##b
+#define CORE_CAT(a, b) CORE_CAT_(a, b)
+#define CORE(name) CORE_CAT(CORE_NAME, name)
+
+// the handlers with quirks, with this profile's filled in
+static void CORE(rshift)(chip8 *ch8, const chip8_instr *in) {
+  chip8_op_rshift(ch8, in, CORE_QUIRKS);
+}
+
+static void CORE(lshift)(chip8 *ch8, const chip8_instr *in) {
+  chip8_op_lshift(ch8, in, CORE_QUIRKS);
+}
+
+static void CORE(jump_r0)(chip8 *ch8, const chip8_instr *in) {
+  chip8_op_jump_r0(ch8, in, CORE_QUIRKS);
+}
+
+static void CORE(draw)(chip8 *ch8, const chip8_instr *in) {
+  chip8_op_draw(ch8, in, CORE_QUIRKS);
+}
+
+static void CORE(dump)(chip8 *ch8, const chip8_instr *in) {
+  chip8_op_dump(ch8, in, CORE_QUIRKS);
+}
+
+static void CORE(fill)(chip8 *ch8, const chip8_instr *in) {
+  chip8_op_fill(ch8, in, CORE_QUIRKS);
+}
+
+static const chip8_handler CORE(handlers)[CHIP8_OP_COUNT] = {
+  [CHIP8_OP_INVALID] = chip8_op_invalid,
+  [CHIP8_OP_BREAK] = chip8_op_break,
+  [CHIP8_OP_CLEAR] = chip8_op_clear,
+  [CHIP8_OP_RETURN] = chip8_op_return,
+  [CHIP8_OP_JUMP] = chip8_op_jump,
+  [CHIP8_OP_SUBROUTINE] = chip8_op_subroutine,
+  [CHIP8_OP_IFNEQ] = chip8_op_ifneq,
+  [CHIP8_OP_IFEQ] = chip8_op_ifeq,
+  [CHIP8_OP_IFNEQ_R] = chip8_op_ifneq_r,
+  [CHIP8_OP_PIXEL] = chip8_op_pixel,
+  [CHIP8_OP_SET] = chip8_op_set,
+  [CHIP8_OP_ADD] = chip8_op_add,
+  [CHIP8_OP_SET_R] = chip8_op_set_r,
+  [CHIP8_OP_OR] = chip8_op_or,
+  [CHIP8_OP_AND] = chip8_op_and,
+  [CHIP8_OP_XOR] = chip8_op_xor,
+  [CHIP8_OP_ADD_R] = chip8_op_add_r,
+  [CHIP8_OP_SUB] = chip8_op_sub,
+  [CHIP8_OP_RSHIFT] = CORE(rshift),
+  [CHIP8_OP_REVSUB] = chip8_op_revsub,
+  [CHIP8_OP_LSHIFT] = CORE(lshift),
+  [CHIP8_OP_IFEQ_R] = chip8_op_ifeq_r,
+  [CHIP8_OP_SET_I] = chip8_op_set_i,
+  [CHIP8_OP_JUMP_R0] = CORE(jump_r0),
+  [CHIP8_OP_RANDOM] = chip8_op_random,
+  [CHIP8_OP_DRAW] = CORE(draw),
+  [CHIP8_OP_IFNKEY] = chip8_op_ifnkey,
+  [CHIP8_OP_IFKEY] = chip8_op_ifkey,
+  [CHIP8_OP_GET_TIMER] = chip8_op_get_timer,
+  [CHIP8_OP_AWAIT] = chip8_op_await,
+  [CHIP8_OP_SET_TIMER] = chip8_op_set_timer,
+  [CHIP8_OP_SET_SOUND] = chip8_op_set_sound,
+  [CHIP8_OP_ADD_I] = chip8_op_add_i,
+  [CHIP8_OP_SETSPRITE] = chip8_op_setsprite,
+  [CHIP8_OP_BCD] = chip8_op_bcd,
+  [CHIP8_OP_DUMP] = CORE(dump),
+  [CHIP8_OP_FILL] = CORE(fill),
+};
+
+// Fetch, decode and execute with every handler inlined.
+// Only handlers that can stop the machine (or chip8_run) are followed
+// by a check, the rest go straight to the next instruction.
+static uint32_t CORE(run)(chip8 *ch8, uint32_t cycles) {
+  uint32_t ran = 0;
+
+  while (ran < cycles) {
+    const chip8_instr *in = chip8_fetch(ch8);
+    ran++;
+
+    switch (in->op) {
+      case CHIP8_OP_INVALID: chip8_op_invalid(ch8, in); break;
+      case CHIP8_OP_BREAK: chip8_op_break(ch8, in); break;
+      case CHIP8_OP_CLEAR: chip8_op_clear(ch8, in); break;
+      case CHIP8_OP_RETURN: chip8_op_return(ch8, in); break;
+      case CHIP8_OP_JUMP: {
+        word from = ch8->PC;
+        chip8_op_jump(ch8, in);
+        ran += chip8_idle_after_jump(ch8, from, cycles - ran);
+        continue;
+      }
+      case CHIP8_OP_SUBROUTINE: chip8_op_subroutine(ch8, in); break;
+      case CHIP8_OP_IFNEQ: chip8_op_ifneq(ch8, in); continue;
+      case CHIP8_OP_IFEQ: chip8_op_ifeq(ch8, in); continue;
+      case CHIP8_OP_IFNEQ_R: chip8_op_ifneq_r(ch8, in); continue;
+      case CHIP8_OP_PIXEL: chip8_op_pixel(ch8, in); break;
+      case CHIP8_OP_SET: chip8_op_set(ch8, in); continue;
+      case CHIP8_OP_ADD: chip8_op_add(ch8, in); continue;
+      case CHIP8_OP_SET_R: chip8_op_set_r(ch8, in); continue;
+      case CHIP8_OP_OR: chip8_op_or(ch8, in); continue;
+      case CHIP8_OP_AND: chip8_op_and(ch8, in); continue;
+      case CHIP8_OP_XOR: chip8_op_xor(ch8, in); continue;
+      case CHIP8_OP_ADD_R: chip8_op_add_r(ch8, in); continue;
+      case CHIP8_OP_SUB: chip8_op_sub(ch8, in); continue;
+      case CHIP8_OP_RSHIFT: chip8_op_rshift(ch8, in, CORE_QUIRKS); continue;
+      case CHIP8_OP_REVSUB: chip8_op_revsub(ch8, in); continue;
+      case CHIP8_OP_LSHIFT: chip8_op_lshift(ch8, in, CORE_QUIRKS); continue;
+      case CHIP8_OP_IFEQ_R: chip8_op_ifeq_r(ch8, in); continue;
+      case CHIP8_OP_SET_I: chip8_op_set_i(ch8, in); continue;
+      case CHIP8_OP_JUMP_R0: chip8_op_jump_r0(ch8, in, CORE_QUIRKS); continue;
+      case CHIP8_OP_RANDOM: chip8_op_random(ch8, in); continue;
+      case CHIP8_OP_DRAW: chip8_op_draw(ch8, in, CORE_QUIRKS); break;
+      case CHIP8_OP_IFNKEY: chip8_op_ifnkey(ch8, in); continue;
+      case CHIP8_OP_IFKEY: chip8_op_ifkey(ch8, in); continue;
+      case CHIP8_OP_GET_TIMER: chip8_op_get_timer(ch8, in); continue;
+      case CHIP8_OP_AWAIT: chip8_op_await(ch8, in); break;
+      case CHIP8_OP_SET_TIMER: chip8_op_set_timer(ch8, in); continue;
+      case CHIP8_OP_SET_SOUND: chip8_op_set_sound(ch8, in); continue;
+      case CHIP8_OP_ADD_I: chip8_op_add_i(ch8, in); continue;
+      case CHIP8_OP_SETSPRITE: chip8_op_setsprite(ch8, in); continue;
+      case CHIP8_OP_BCD: chip8_op_bcd(ch8, in); continue;
+      case CHIP8_OP_DUMP: chip8_op_dump(ch8, in, CORE_QUIRKS); break;
+      case CHIP8_OP_FILL: chip8_op_fill(ch8, in, CORE_QUIRKS); break;
+    }
+
+    if (ch8->quit || ch8->stop) break;
+  }
+
+  return ran;
+}
+
+#undef CORE_CAT_
+#undef CORE_CAT
+#undef CORE
+#undef CORE_NAME
+#undef CORE_QUIRKS
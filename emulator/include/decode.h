@@ -0,0 +1,66 @@
+#pragma once
+
+#include "typedefs.h"
+
+// One entry per instruction kind. The names follow the assembler's mnemonics.
+typedef enum {
+  CHIP8_OP_INVALID,
+
+  CHIP8_OP_BREAK,      // 0000 (non-standard)
+  CHIP8_OP_CLEAR,      // 00E0
+  CHIP8_OP_RETURN,     // 00EE
+  CHIP8_OP_JUMP,       // 1NNN
+  CHIP8_OP_SUBROUTINE, // 2NNN
+  CHIP8_OP_IFNEQ,      // 3XNN
+  CHIP8_OP_IFEQ,       // 4XNN
+  CHIP8_OP_IFNEQ_R,    // 5XY0
+  CHIP8_OP_PIXEL,      // 5XY1 (non-standard)
+  CHIP8_OP_SET,        // 6XNN
+  CHIP8_OP_ADD,        // 7XNN
+  CHIP8_OP_SET_R,      // 8XY0
+  CHIP8_OP_OR,         // 8XY1
+  CHIP8_OP_AND,        // 8XY2
+  CHIP8_OP_XOR,        // 8XY3
+  CHIP8_OP_ADD_R,      // 8XY4
+  CHIP8_OP_SUB,        // 8XY5
+  CHIP8_OP_RSHIFT,     // 8XY6
+  CHIP8_OP_REVSUB,     // 8XY7
+  CHIP8_OP_LSHIFT,     // 8XYE
+  CHIP8_OP_IFEQ_R,     // 9XY0
+  CHIP8_OP_SET_I,      // ANNN
+  CHIP8_OP_JUMP_R0,    // BNNN
+  CHIP8_OP_RANDOM,     // CXNN
+  CHIP8_OP_DRAW,       // DXYN
+  CHIP8_OP_IFNKEY,     // EX9E
+  CHIP8_OP_IFKEY,      // EXA1
+  CHIP8_OP_GET_TIMER,  // FX07
+  CHIP8_OP_AWAIT,      // FX0A
+  CHIP8_OP_SET_TIMER,  // FX15
+  CHIP8_OP_SET_SOUND,  // FX18
+  CHIP8_OP_ADD_I,      // FX1E
+  CHIP8_OP_SETSPRITE,  // FX29
+  CHIP8_OP_BCD,        // FX33
+  CHIP8_OP_DUMP,       // FX55
+  CHIP8_OP_FILL,       // FX65
+
+  CHIP8_OP_COUNT
+} chip8_opcode;
+
+// An instruction with all of its operands already pulled apart,
+// so handlers never have to touch the raw 2 bytes again.
+typedef struct {
+  byte op;   // chip8_opcode
+  byte x;    // 0X00
+  byte y;    // 00Y0
+  byte n;    // 000N
+  byte nn;   // 00NN
+  word nnn;  // 0NNN
+} chip8_instr;
+
+// 64K entries, indexed by the whole 2-byte instruction
+extern chip8_instr chip8_decode_table[0x10000];
+
+// Fills chip8_decode_table. Cheap to call more than once.
+void chip8_decode_init(void);
+
+chip8_instr chip8_decode(word w);
@@ -0,0 +1,30 @@
+#pragma once
+
+// Idle loops: short loops that only wait for the timer or a key, like
+//
+//   loop: SET R0, TIMER
+//         IFNEQ R0, 0
+//         JUMP loop
+//
+// Until the next timer tick, or until the keys change from outside,
+// every time round such a loop does exactly the same thing, so the
+// backends skip straight to the end of their budget instead of running
+// it millions of times. The machine ends up exactly where running it
+// would have left it.
+
+#include "chip8.h"
+
+// longest loop looked for, in instructions
+#define CHIP8_IDLE_MAX_LOOP 8
+
+// With PC at the top of a loop, the cycles it skips (a whole number of
+// times round), or 0 if the loop isn't idle. The budget must not go past
+// the next timer tick, which chip8_run already sees to.
+uint32_t chip8_idle_skip(chip8*, uint32_t budget);
+
+// For the backends, right after jumping from `from`: only a jump a
+// little way back can close a loop worth looking at.
+static inline uint32_t chip8_idle_after_jump(chip8 *ch8, word from, uint32_t budget) {
+  if (ch8->PC > from || from - ch8->PC >= 2*CHIP8_IDLE_MAX_LOOP) return 0;
+  return chip8_idle_skip(ch8, budget);
+}
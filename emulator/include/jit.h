@@ -0,0 +1,27 @@
+#pragma once
+
+// Optional x86-64 recompiler.
+// Straight-line runs of instructions ("blocks") are translated to native
+// code the first time they're reached and cached by their start address.
+// A block ends at the first jump, skip, call/return, draw, or anything that
+// can stop the machine or write to memory.
+// Writing to memory that holds translated code throws the whole cache away.
+//
+// On anything other than x86-64 chip8_jit_enable just returns false.
+
+#include "chip8.h"
+
+// Sets up the code buffer. Returns false if the host can't run it.
+bool chip8_jit_enable(chip8*);
+void chip8_jit_disable(chip8*);
+
+// Throw away every translated block, e.g. after loading a new ROM.
+void chip8_jit_reset(chip8*);
+
+// Called for every memory write while the recompiler is on.
+void chip8_jit_invalidate(struct chip8_jit*, word addr);
+
+// Runs up to `cycles` instructions, stopping early if the machine quits
+// or an instruction sets ch8->stop.
+// Returns how many instructions were executed.
+uint32_t chip8_jit_run(chip8*, uint32_t cycles);
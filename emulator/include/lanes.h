@@ -0,0 +1,56 @@
+#pragma once
+
+// Runs several copies of one ROM side by side, e.g. with different inputs.
+// The registers, I, PC and timers of every lane sit together in arrays
+// (one array per register, one element per lane), and each step runs one
+// instruction for every lane at the same PC, with the lanes elsewhere
+// masked out. The lane with the most cycles still to run picks the PC, so
+// lanes that went different ways meet up again when they reach the same
+// code. While the lanes agree on PC, an ALU or branch instruction costs
+// about one instruction for all of them, and the loops over the lanes are
+// written for the compiler to vectorize. Everything else (drawing, the
+// stack, memory writes, random numbers) runs one lane at a time through
+// the profile's handlers.
+//
+// Each lane is still a whole chip8 in `lane`, for setting keys and reading
+// the results; chip8_lanes_run copies the registers in and back out.
+
+#include "chip8.h"
+#include "quirks.h"
+
+// up to 32, the masks are 32-bit
+#ifndef CHIP8_LANES
+#define CHIP8_LANES 16
+#endif
+
+typedef struct {
+  chip8 lane[CHIP8_LANES];
+  int count;
+
+  // lockstep steps taken, to see how well the lanes stay together
+  uint64_t steps;
+
+  // only valid inside chip8_lanes_run
+  _Alignas(64) byte R[16][CHIP8_LANES];
+  word I[CHIP8_LANES];
+  word PC[CHIP8_LANES];
+  byte timer[CHIP8_LANES];
+  byte sound[CHIP8_LANES];
+  uint32_t tick_left[CHIP8_LANES];
+  uint32_t ticked[CHIP8_LANES];
+  uint32_t left[CHIP8_LANES]; // instructions still to run this time
+} chip8_lanes;
+
+// A new set of `count` lanes (at most CHIP8_LANES), each chip8_init'ed.
+// NULL if out of memory.
+chip8_lanes *chip8_lanes_create(int count);
+void chip8_lanes_destroy(chip8_lanes*);
+
+// Loads the same ROM into every lane. The lanes must always share a ROM
+// and a profile, only their keys (and what follows from them) differ.
+bool chip8_lanes_loadrom(chip8_lanes*, const byte *rom, long length);
+void chip8_lanes_set_profile(chip8_lanes*, chip8_profile);
+
+// Runs every lane for `cycles` instructions, the same as calling chip8_run
+// on each until it has used them all. Lanes that quit stay stopped.
+void chip8_lanes_run(chip8_lanes*, uint32_t cycles);
@@ -0,0 +1,82 @@
+#pragma once
+
+// Input movies: the keys a session pressed, so it can be played back
+// exactly, e.g. to time the same game on two builds of the emulator.
+//
+// A movie remembers how the machine was set up (profile, clock speed,
+// random number state, a hash of the program) and then one event each
+// time the held keys change, as a 16-bit mask (bit k for key k) stamped
+// with the cycle it took effect at. chip8_run's result only depends on
+// the cycles run, so putting the same keys in at the same cycles gives
+// the same machine.
+//
+// The file is little-endian binary:
+//
+//   header: "CH8M", u32 version (1), u32 profile, u32 cycles per tick,
+//           u64 random number state, u64 program hash,
+//           u64 cycles at the end, u32 event count
+//   then per event: u64 cycle, u16 key mask
+
+#include "chip8.h"
+#include "quirks.h"
+
+#define CHIP8_MOVIE_VERSION 1
+
+typedef struct {
+  uint64_t cycle;
+  uint16_t keys;
+} chip8_movie_event;
+
+typedef struct {
+  chip8_profile profile;
+  uint32_t cycles_per_tick;
+  uint64_t rng;
+  uint64_t rom_hash;
+  uint64_t end_cycles;
+
+  chip8_movie_event *events;
+  int count, capacity;
+
+  // the next event to play back
+  int next;
+} chip8_movie;
+
+static inline uint16_t chip8_get_keys(const chip8 *ch8) {
+  uint16_t mask = 0;
+  for (int k=0; k<16; k++) mask |= (uint16_t)ch8->keys[k] << k;
+  return mask;
+}
+
+static inline void chip8_set_keys(chip8 *ch8, uint16_t mask) {
+  for (int k=0; k<16; k++) ch8->keys[k] = (mask >> k) & 1;
+}
+
+// Starts recording a machine that's set up and hasn't run yet.
+// Returns false if out of memory.
+bool chip8_movie_record_start(chip8_movie*, const chip8*);
+
+// Holds `keys` from now on, recording them if they changed.
+void chip8_movie_record(chip8_movie*, chip8*, uint16_t keys);
+
+// Marks where the recording ends, before saving it.
+void chip8_movie_record_stop(chip8_movie*, const chip8*);
+
+// Sets up a machine that has the ROM loaded and hasn't run yet the way
+// the movie was recorded, and rewinds the movie to the start. Returns
+// false, with the machine untouched, if it's a different program.
+bool chip8_movie_play_start(chip8_movie*, chip8*);
+
+// Presses whatever keys the movie holds at this cycle. Returns false once
+// the movie has run out, after which the keys are up to the caller.
+bool chip8_movie_play(chip8_movie*, chip8*);
+
+// Cycles until the movie next changes the keys (or ends), at most `max`.
+// Running no further than this between chip8_movie_play calls makes
+// playback exact however the caller splits up the run.
+uint32_t chip8_movie_cycles_until_event(const chip8_movie*, const chip8*, uint32_t max);
+
+// Returns false if the file can't be written or read, or isn't a movie.
+bool chip8_movie_save(const chip8_movie*, const char *path);
+bool chip8_movie_load(chip8_movie*, const char *path);
+
+void chip8_movie_free(chip8_movie*);
@@ -0,0 +1,403 @@
+#pragma once
+
+// What every instruction actually does.
+// Kept in a header so every way of running code uses the exact same behavior.
+// Handlers for instructions with quirks take the profile's quirk flags
+// as a last argument; callers pass a constant so the checks fold away.
+
+#include "chip8.h"
+#include "decode.h"
+#include "quirks.h"
+
+#include <string.h>
+
+// The decoded instruction at PC
+static inline const chip8_instr *chip8_fetch(chip8 *ch8) {
+  byte high, low;
+#ifdef CHIP8_CHECKED_MEMORY
+  high = chip8_read(ch8, ch8->PC);
+  low = chip8_read(ch8, (ch8->PC)+1);
+#else
+  // running off the end wraps around to 0
+  word pc = ch8->PC;
+  high = ch8->mem[pc & CHIP8_ADDR_MASK];
+  low = ch8->mem[(pc+1) & CHIP8_ADDR_MASK];
+#endif
+  return &chip8_decode_table[(high << 8) | low];
+}
+
+static inline void chip8_advance(chip8 *ch8) {
+  ch8->PC += 2;
+}
+
+static inline void chip8_clear(chip8 *ch8) {
+  // only rows with something on them actually change
+  uint32_t dirty = 0;
+  for (int y=0; y<CHIP8_SCREEN_H; y++) {
+    if (ch8->screen[y] != 0) dirty |= (uint32_t)1 << y;
+  }
+
+  if (dirty != 0) {
+    memset(ch8->screen, 0, sizeof(ch8->screen));
+    ch8->dirty_rows |= dirty;
+    ch8->screen_changed = true;
+  }
+}
+
+static inline void chip8_jump(chip8 *ch8, word destination) {
+  ch8->PC = destination;
+}
+
+static inline void chip8_subroutine(chip8 *ch8, word destination) {
+  if (ch8->SP >= CHIP8_STACK_SIZE) {
+    chip8_error(ch8, "Stack overflow");
+    return;
+  }
+
+  ch8->stack[ch8->SP] = ch8->PC;
+  ch8->SP++;
+  ch8->PC = destination;
+}
+
+static inline void chip8_return(chip8 *ch8) {
+  if (ch8->SP == 0) {
+    chip8_error(ch8, "Stack underflow");
+  } else if (ch8->SP >= CHIP8_STACK_SIZE) {
+    chip8_error(ch8, "Stack overflow");
+  } else {
+    ch8->SP--;
+    ch8->PC = ch8->stack[ch8->SP];
+    chip8_advance(ch8);
+  }
+}
+
+static inline void chip8_pixel(chip8 *ch8, byte x, byte y) {
+  if (x < CHIP8_SCREEN_W && y < CHIP8_SCREEN_H) {
+    ch8->screen[y] ^= (uint64_t)1 << (CHIP8_SCREEN_W-1 - x);
+    ch8->dirty_rows |= (uint32_t)1 << y;
+    ch8->screen_changed = true;
+  }
+}
+
+// XORs a sprite onto the screen, clipping at the edges (or wrapping).
+// RF is set to 1 if any pixel was turned off, 0 otherwise.
+static inline void chip8_draw(chip8 *ch8, byte x, byte y, byte height, int quirks) {
+
+  word addr = ch8->I;
+  uint64_t collision = 0;
+
+  if (quirks & (CHIP8_QUIRK_WRAP_START | CHIP8_QUIRK_WRAP_PIXELS)) {
+    x %= CHIP8_SCREEN_W;
+    y %= CHIP8_SCREEN_H;
+  }
+
+  if (quirks & CHIP8_QUIRK_WRAP_PIXELS) {
+    for (int i=0; i<height; i++) {
+      uint64_t sprite = (uint64_t)chip8_read(ch8, addr+i) << (CHIP8_SCREEN_W-8);
+
+      // rotate, so whatever falls off the right comes back on the left
+      uint64_t row = (sprite >> x) | (sprite << ((CHIP8_SCREEN_W - x) % CHIP8_SCREEN_W));
+      if (row == 0) continue;
+
+      int yy = (y+i) % CHIP8_SCREEN_H;
+      collision |= ch8->screen[yy] & row;
+      ch8->screen[yy] ^= row;
+      ch8->dirty_rows |= (uint32_t)1 << yy;
+      ch8->screen_changed = true;
+    }
+  } else if (x < CHIP8_SCREEN_W) {
+    for (int i=0; i<height && y+i < CHIP8_SCREEN_H; i++) {
+      uint64_t sprite = chip8_read(ch8, addr+i);
+
+      // line the sprite's 8 bits up with column x
+      uint64_t row;
+      if (x <= CHIP8_SCREEN_W-8)
+        row = sprite << (CHIP8_SCREEN_W-8 - x);
+      else
+        row = sprite >> (x - (CHIP8_SCREEN_W-8));
+
+      if (row == 0) continue;
+
+      collision |= ch8->screen[y+i] & row;
+      ch8->screen[y+i] ^= row;
+      ch8->dirty_rows |= (uint32_t)1 << (y+i);
+      ch8->screen_changed = true;
+    }
+  }
+
+  ch8->R[0xF] = collision != 0;
+
+}
+
+static inline void chip8_op_invalid(chip8 *ch8, const chip8_instr *in) {
+  chip8_error(ch8, "Invalid instruction");
+}
+
+// 0000 NON-STANDARD: BREAK
+static inline void chip8_op_break(chip8 *ch8, const chip8_instr *in) {
+  ch8->quit = true;
+}
+
+// 00E0: CLEAR
+static inline void chip8_op_clear(chip8 *ch8, const chip8_instr *in) {
+  chip8_clear(ch8);
+  ch8->stop = CHIP8_STOP_DRAW;
+  chip8_advance(ch8);
+}
+
+// 00EE: RETURN
+static inline void chip8_op_return(chip8 *ch8, const chip8_instr *in) {
+  chip8_return(ch8);
+}
+
+// 1NNN: JUMP
+static inline void chip8_op_jump(chip8 *ch8, const chip8_instr *in) {
+  chip8_jump(ch8, in->nnn);
+}
+
+// 2NNN: SUBROUTINE
+static inline void chip8_op_subroutine(chip8 *ch8, const chip8_instr *in) {
+  chip8_subroutine(ch8, in->nnn);
+}
+
+// 3XNN: IFNEQ (SKIP NEXT IF RX = NN)
+static inline void chip8_op_ifneq(chip8 *ch8, const chip8_instr *in) {
+  if (ch8->R[in->x] == in->nn) {
+    chip8_advance(ch8);
+  }
+  chip8_advance(ch8);
+}
+
+// 4XNN: IFEQ (SKIP NEXT IF RX != NN)
+static inline void chip8_op_ifeq(chip8 *ch8, const chip8_instr *in) {
+  if (ch8->R[in->x] != in->nn) {
+    chip8_advance(ch8);
+  }
+  chip8_advance(ch8);
+}
+
+// 5XY0: IFNEQ (SKIP NEXT IF RX = RY)
+static inline void chip8_op_ifneq_r(chip8 *ch8, const chip8_instr *in) {
+  if (ch8->R[in->x] == ch8->R[in->y]) {
+    chip8_advance(ch8);
+  }
+  chip8_advance(ch8);
+}
+
+// 5XY1 NON-STANDARD: PIXEL
+static inline void chip8_op_pixel(chip8 *ch8, const chip8_instr *in) {
+  chip8_pixel(ch8, ch8->R[in->x], ch8->R[in->y]);
+  ch8->stop = CHIP8_STOP_DRAW;
+  chip8_advance(ch8);
+}
+
+// 6XNN: SET RX, NN
+static inline void chip8_op_set(chip8 *ch8, const chip8_instr *in) {
+  ch8->R[in->x] = in->nn;
+  chip8_advance(ch8);
+}
+
+// 7XNN: ADD RX, NN
+static inline void chip8_op_add(chip8 *ch8, const chip8_instr *in) {
+  ch8->R[in->x] += in->nn; // no carry flag change!
+  chip8_advance(ch8);
+}
+
+// 8XY0: SET RX, RY
+static inline void chip8_op_set_r(chip8 *ch8, const chip8_instr *in) {
+  ch8->R[in->x] = ch8->R[in->y];
+  chip8_advance(ch8);
+}
+
+// 8XY1: OR RX, RY
+static inline void chip8_op_or(chip8 *ch8, const chip8_instr *in) {
+  ch8->R[in->x] |= ch8->R[in->y];
+  chip8_advance(ch8);
+}
+
+// 8XY2: AND RX, RY
+static inline void chip8_op_and(chip8 *ch8, const chip8_instr *in) {
+  ch8->R[in->x] &= ch8->R[in->y];
+  chip8_advance(ch8);
+}
+
+// 8XY3: XOR RX, RY
+static inline void chip8_op_xor(chip8 *ch8, const chip8_instr *in) {
+  ch8->R[in->x] ^= ch8->R[in->y];
+  chip8_advance(ch8);
+}
+
+// 8XY4: ADD RX, RY
+static inline void chip8_op_add_r(chip8 *ch8, const chip8_instr *in) {
+  // set RF if overflow
+  if (ch8->R[in->x] + ch8->R[in->y] > 255)
+    ch8->R[0xF] = 1;
+  else
+    ch8->R[0xF] = 0;
+
+  ch8->R[in->x] += ch8->R[in->y];
+  chip8_advance(ch8);
+}
+
+// 8XY5: SUB RX, RY
+static inline void chip8_op_sub(chip8 *ch8, const chip8_instr *in) {
+  // set RF if no borrow
+  if (ch8->R[in->x] >= ch8->R[in->y])
+    ch8->R[0xF] = 1;
+  else
+    ch8->R[0xF] = 0;
+
+  ch8->R[in->x] -= ch8->R[in->y];
+  chip8_advance(ch8);
+}
+
+// 8XY6: RSHIFT RX
+static inline void chip8_op_rshift(chip8 *ch8, const chip8_instr *in, int quirks) {
+  byte src = (quirks & CHIP8_QUIRK_SHIFT_VY) ? in->y : in->x;
+
+  // set RF to the source's LSB
+  ch8->R[0xF] = ch8->R[src] & 0x01;
+  ch8->R[in->x] = ch8->R[src] >> 1;
+  chip8_advance(ch8);
+}
+
+// 8XY7: REVSUB RX, RY
+static inline void chip8_op_revsub(chip8 *ch8, const chip8_instr *in) {
+  if (ch8->R[in->x] > ch8->R[in->y])
+    ch8->R[0xF] = 1;
+  else
+    ch8->R[0xF] = 0;
+
+  ch8->R[in->x] = ch8->R[in->y] - ch8->R[in->x];
+  chip8_advance(ch8);
+}
+
+// 8XYE: LSHIFT RX
+static inline void chip8_op_lshift(chip8 *ch8, const chip8_instr *in, int quirks) {
+  byte src = (quirks & CHIP8_QUIRK_SHIFT_VY) ? in->y : in->x;
+
+  ch8->R[0xF] = (ch8->R[src] & 128) >> 7;
+  ch8->R[in->x] = ch8->R[src] << 1;
+  chip8_advance(ch8);
+}
+
+// 9XY0: IFEQ RX, RY (SKIP NEXT IF RX != RY)
+static inline void chip8_op_ifeq_r(chip8 *ch8, const chip8_instr *in) {
+  if (ch8->R[in->x] != ch8->R[in->y]) {
+    chip8_advance(ch8);
+  }
+  chip8_advance(ch8);
+}
+
+// ANNN: SET I, NNN
+static inline void chip8_op_set_i(chip8 *ch8, const chip8_instr *in) {
+  ch8->I = in->nnn;
+  chip8_advance(ch8);
+}
+
+// BNNN: JUMP NNN, R0 (NNN + R0)
+static inline void chip8_op_jump_r0(chip8 *ch8, const chip8_instr *in, int quirks) {
+  byte r = (quirks & CHIP8_QUIRK_JUMP_VX) ? in->x : 0;
+  chip8_jump(ch8, in->nnn + ch8->R[r]);
+}
+
+// CXNN: RANDOM RX, NN (RX = RANDOM BYTE & NN)
+static inline void chip8_op_random(chip8 *ch8, const chip8_instr *in) {
+  ch8->R[in->x] = chip8_random(ch8) & in->nn;
+  chip8_advance(ch8);
+}
+
+// DXYN: DRAW RX, RY, N
+static inline void chip8_op_draw(chip8 *ch8, const chip8_instr *in, int quirks) {
+  chip8_draw(ch8, ch8->R[in->x], ch8->R[in->y], in->n, quirks);
+  ch8->stop = CHIP8_STOP_DRAW;
+  chip8_advance(ch8);
+}
+
+// EX9E: IFNKEY RX (SKIP NEXT IF KEY IN RX IS PRESSED)
+static inline void chip8_op_ifnkey(chip8 *ch8, const chip8_instr *in) {
+  byte key = ch8->R[in->x] & 0x0F;
+  if (ch8->keys[key]) {
+    chip8_advance(ch8);
+  }
+  chip8_advance(ch8);
+}
+
+// EXA1: IFKEY RX (SKIP NEXT IF KEY IN RX IS NOT PRESSED)
+static inline void chip8_op_ifkey(chip8 *ch8, const chip8_instr *in) {
+  byte key = ch8->R[in->x] & 0x0F;
+  if (!ch8->keys[key]) {
+    chip8_advance(ch8);
+  }
+  chip8_advance(ch8);
+}
+
+// FX07: SET RX, TIMER
+static inline void chip8_op_get_timer(chip8 *ch8, const chip8_instr *in) {
+  ch8->R[in->x] = ch8->timer;
+  chip8_advance(ch8);
+}
+
+// FX0A: AWAIT KEYPRESS
+static inline void chip8_op_await(chip8 *ch8, const chip8_instr *in) {
+  for (int i=0; i<16; i++) {
+    if (ch8->keys[i]) {
+      ch8->R[in->x] = i;
+      chip8_advance(ch8);
+      return;
+    }
+  }
+
+  // no key yet, PC stays here so it runs again next time
+  ch8->stop = CHIP8_STOP_KEYWAIT;
+}
+
+// FX15: SET TIMER, RX
+static inline void chip8_op_set_timer(chip8 *ch8, const chip8_instr *in) {
+  ch8->timer = ch8->R[in->x];
+  chip8_advance(ch8);
+}
+
+// FX18: SET SOUND, RX
+static inline void chip8_op_set_sound(chip8 *ch8, const chip8_instr *in) {
+  ch8->sound = ch8->R[in->x];
+  chip8_advance(ch8);
+}
+
+// FX1E: ADD I, RX
+static inline void chip8_op_add_i(chip8 *ch8, const chip8_instr *in) {
+  ch8->I += ch8->R[in->x];
+  chip8_advance(ch8);
+}
+
+// FX29: SETSPRITE RX
+static inline void chip8_op_setsprite(chip8 *ch8, const chip8_instr *in) {
+  ch8->I = (ch8->R[in->x] & 0x0F) * 5;
+  chip8_advance(ch8);
+}
+
+// FX33: BCD RX
+static inline void chip8_op_bcd(chip8 *ch8, const chip8_instr *in) {
+  //todo
+  chip8_advance(ch8);
+}
+
+// FX55: DUMP RX
+static inline void chip8_op_dump(chip8 *ch8, const chip8_instr *in, int quirks) {
+  // the write can invalidate *in if it points into a decode cache
+  byte x = in->x;
+  for (int i=0; i<=x; i++) {
+    chip8_write(ch8, i+ch8->I, ch8->R[i]);
+  }
+  if (quirks & CHIP8_QUIRK_INCREMENT_I) ch8->I += x+1;
+  chip8_advance(ch8);
+}
+
+// FX65: FILL RX
+static inline void chip8_op_fill(chip8 *ch8, const chip8_instr *in, int quirks) {
+  for (int i=0; i<=in->x; i++) {
+    ch8->R[i] = chip8_read(ch8, i+ch8->I);
+  }
+  if (quirks & CHIP8_QUIRK_INCREMENT_I) ch8->I += in->x+1;
+  chip8_advance(ch8);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// Turning the 1-bit screen into 32-bit pixels for a texture or a video frame.
+// Uses AVX2 or SSE2 when the compiler targets them, plain C otherwise.
+// Define CHIP8_PIXELS_SIMD as 2 (AVX2), 1 (SSE2) or 0 (plain C) to pick one.
+
+#include "chip8.h"
+
+// Writes CHIP8_SCREEN_W*scale by CHIP8_SCREEN_H*scale pixels to `out`,
+// each CHIP-8 pixel becoming a scale x scale square of `on` or `off`.
+// `pitch` is the length of one output row in bytes, like SDL's.
+// The colors are copied as-is, so any 32-bit format works.
+void chip8_expand_screen(const uint64_t screen[CHIP8_SCREEN_H], uint32_t *out, int pitch,
+                         int scale, uint32_t on, uint32_t off);
+
+// Same, for `count` screen rows starting at `rows` (e.g. just the dirty ones).
+void chip8_expand_rows(const uint64_t *rows, int count, uint32_t *out, int pitch,
+                       int scale, uint32_t on, uint32_t off);
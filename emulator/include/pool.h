@@ -0,0 +1,49 @@
+#pragma once
+
+// Forking: many copies of one running game, for tree searches that try
+// out thousands of moves a frame.
+//
+// Most of a machine's memory is the ROM and the font, which nothing ever
+// writes to, so two machines that hold the same ROM only differ where
+// either of them wrote (see chip8.written). chip8_fork copies just those
+// 64-byte chunks, plus the registers and the screen. A pool hands out
+// machines that already hold the ROM, so they never need the whole
+// 4 KiB copied again, and keeps them around between searches.
+
+#include "chip8.h"
+
+// Makes dst a copy of src. dst must already hold the same ROM: taken from
+// a pool of it, forked from it before, or chip8_init'ed and loaded with it.
+// The backends aren't shared, dst keeps whatever it had enabled.
+void chip8_fork(const chip8 *src, chip8 *dst);
+
+struct chip8_pool_slab;
+
+typedef struct {
+  // what new machines start as
+  const chip8 *root;
+
+  // machines handed back, ready to reuse
+  chip8 **free;
+  int nFree;
+
+  // every machine the pool owns, in blocks that double in size
+  struct chip8_pool_slab *slabs;
+  int total;
+} chip8_pool;
+
+// A pool of copies of root, which must stay around as long as the pool.
+// The copies don't have any backend enabled. NULL if out of memory.
+chip8_pool *chip8_pool_create(const chip8 *root);
+
+// Frees every machine the pool handed out, too.
+void chip8_pool_destroy(chip8_pool*);
+
+// A machine holding the root's ROM, in whatever state it was handed back
+// in (fork into it before use). NULL if out of memory.
+chip8 *chip8_pool_alloc(chip8_pool*);
+
+// chip8_pool_alloc, then chip8_fork from src
+chip8 *chip8_pool_fork(chip8_pool*, const chip8 *src);
+
+void chip8_pool_release(chip8_pool*, chip8*);
@@ -0,0 +1,60 @@
+#pragma once
+
+// The things CHIP-8 variants disagree on, and the profiles built from them.
+// Each profile gets its own core (see core.h and cores.c) and threaded loop
+// (threaded_core.h) with the quirks baked in at compile time, so nothing
+// checks them while running.
+
+#include "chip8.h"
+#include "decode.h"
+
+// 8XY6/8XYE shift RY into RX, instead of shifting RX in place
+#define CHIP8_QUIRK_SHIFT_VY 0x01
+// FX55/FX65 leave I just past the last register
+#define CHIP8_QUIRK_INCREMENT_I 0x02
+// BXNN jumps to XNN + RX, instead of BNNN to NNN + R0
+#define CHIP8_QUIRK_JUMP_VX 0x04
+// sprite positions wrap around the screen
+#define CHIP8_QUIRK_WRAP_START 0x08
+// sprites wrap at the edges instead of being clipped
+#define CHIP8_QUIRK_WRAP_PIXELS 0x10
+
+typedef enum {
+  CHIP8_PROFILE_DEFAULT, // this emulator, and everything `asm` makes
+  CHIP8_PROFILE_COSMAC,  // the original COSMAC VIP interpreter
+  CHIP8_PROFILE_SCHIP,   // SUPER-CHIP
+  CHIP8_PROFILE_XOCHIP,  // XO-CHIP
+  CHIP8_PROFILE_COUNT,
+} chip8_profile;
+
+#define CHIP8_QUIRKS_DEFAULT 0
+#define CHIP8_QUIRKS_COSMAC (CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_INCREMENT_I | CHIP8_QUIRK_WRAP_START)
+#define CHIP8_QUIRKS_SCHIP (CHIP8_QUIRK_JUMP_VX | CHIP8_QUIRK_WRAP_START)
+#define CHIP8_QUIRKS_XOCHIP (CHIP8_QUIRK_SHIFT_VY | CHIP8_QUIRK_INCREMENT_I | CHIP8_QUIRK_WRAP_START | CHIP8_QUIRK_WRAP_PIXELS)
+
+extern const char *chip8_profile_names[CHIP8_PROFILE_COUNT];
+extern const int chip8_profile_quirks[CHIP8_PROFILE_COUNT];
+
+// By file extension: .ch8 is COSMAC, .sc8 SUPER-CHIP, .xo8 XO-CHIP,
+// anything else (like .ch8rom) this emulator's own.
+chip8_profile chip8_guess_profile(const char *filename);
+
+// By name, as in chip8_profile_names. Returns CHIP8_PROFILE_COUNT if unknown.
+chip8_profile chip8_profile_by_name(const char *name);
+
+typedef void (*chip8_handler)(chip8*, const chip8_instr*);
+
+typedef struct chip8_core {
+  int quirks;
+  // indexed by chip8_opcode
+  const chip8_handler *handlers;
+  // chip8_step in a loop, stopping like chip8_run does
+  uint32_t (*run)(chip8*, uint32_t cycles);
+} chip8_core;
+
+// indexed by chip8_profile
+extern const chip8_core chip8_cores[CHIP8_PROFILE_COUNT];
+
+// Switches to another profile's core. Throws away anything translated
+// or decoded with the old one.
+void chip8_set_profile(chip8*, chip8_profile);
@@ -0,0 +1,59 @@
+#pragma once
+
+// Rewinding: the last few seconds of save states, one per frame, in a
+// fixed amount of memory.
+//
+// Consecutive frames hardly differ, so most frames are stored as the XOR
+// of their state with the last keyframe (a state stored on its own, every
+// CHIP8_REWIND_KEYFRAME_INTERVAL frames), with the runs of zero bytes left
+// out. A frame then costs a snapshot and one pass over it, and usually a
+// few hundred bytes. When the ring is full the oldest keyframe goes, along
+// with every frame that needs it.
+
+#include "chip8.h"
+#include "snapshot.h"
+
+#include <stddef.h>
+
+#define CHIP8_REWIND_KEYFRAME_INTERVAL 30
+
+typedef struct {
+  uint32_t offset, length; // in data
+  uint64_t keyframe;       // the frame this one is XORed with, itself if a keyframe
+} chip8_rewind_frame;
+
+typedef struct {
+  // the compressed frames, one after the other, wrapping around
+  byte *data;
+  uint32_t size;
+  uint32_t end; // just past the newest frame
+
+  // frame n is in frames[n % capacity], first is the oldest still kept
+  chip8_rewind_frame *frames;
+  uint32_t capacity;
+  uint64_t first, next;
+
+  // the keyframe the newest frames are stored against, if key_valid
+  chip8_savestate key;
+  uint64_t key_frame;
+  bool key_valid;
+
+  chip8_savestate scratch;
+} chip8_rewind;
+
+// Room for up to `frames` frames in `bytes` bytes of data, whichever runs
+// out first. NULL if out of memory or `bytes` can't even hold a few.
+chip8_rewind *chip8_rewind_create(uint32_t frames, uint32_t bytes);
+void chip8_rewind_destroy(chip8_rewind*);
+
+// Saves the machine as the newest frame.
+void chip8_rewind_push(chip8_rewind*, const chip8*);
+
+// Puts the machine back to the newest frame and forgets it, so calling
+// this over and over goes further back. Returns false when there's
+// nothing left.
+bool chip8_rewind_pop(chip8_rewind*, chip8*);
+
+static inline uint32_t chip8_rewind_count(const chip8_rewind *rw) {
+  return rw->next - rw->first;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+// A triple buffer for handing finished screens from the thread running
+// the machine to the one showing them, without either ever waiting.
+//
+// The writer fills its own back buffer and swaps it with the middle one,
+// the reader swaps its front buffer with the middle one whenever there's
+// something new there. The only thing they share is the middle buffer's
+// index, swapped atomically, so the writer can publish as often as it
+// likes and the reader always gets the newest complete screen.
+
+#include "chip8.h"
+
+#include <stdatomic.h>
+
+typedef struct {
+  uint64_t screen[3][CHIP8_SCREEN_H];
+
+  // which buffer is in the middle, plus CHIP8_SCREENBUF_FRESH if the writer
+  // put it there since the reader last took it
+  atomic_uint middle;
+
+  int back;  // only touched by the writer
+  int front; // only touched by the reader
+} chip8_screenbuf;
+
+#define CHIP8_SCREENBUF_FRESH 4
+
+void chip8_screenbuf_init(chip8_screenbuf*);
+
+// Writer: hands over the machine's screen as it is now.
+void chip8_screenbuf_publish(chip8_screenbuf*, const chip8*);
+
+// Reader: the newest screen, or NULL if nothing changed since last time.
+// Stays valid until the next call.
+const uint64_t *chip8_screenbuf_acquire(chip8_screenbuf*);
@@ -0,0 +1,49 @@
+#pragma once
+
+// Save states: everything a running machine needs to carry on from where
+// it was, in one fixed-size block with no pointers in it. It can be copied
+// around, kept in an array or written to a file as it is, and putting it
+// back is little more than a memcpy, so it's cheap enough to take every
+// frame for rewinding, or thousands of times for a search.
+//
+// The front end's own state (the backend caches, the error message) isn't
+// part of it. A state only fits a machine with the same ROM loaded.
+
+#include "chip8.h"
+
+// bump whenever the layout changes
+#define CHIP8_SAVESTATE_VERSION 2
+
+typedef struct {
+  // first, so it starts on a cache line, just like in chip8
+  _Alignas(64) byte mem[CHIP8_MEM_SIZE];
+  uint64_t screen[CHIP8_SCREEN_H];
+  uint64_t written[CHIP8_MEM_SIZE / 64];
+
+  uint64_t rng;
+  uint64_t cycles;
+  uint64_t idle_cycles;
+  uint64_t ticks;
+  uint32_t cycles_per_tick;
+  uint32_t tick_cycles_left;
+
+  uint32_t version;
+
+  word stack[CHIP8_STACK_SIZE];
+  word I;
+  word SP;
+  word PC;
+  byte R[16];
+  byte timer, sound;
+  bool keys[16];
+  bool quit;
+  byte profile; // chip8_profile
+} chip8_savestate;
+
+void chip8_snapshot(const chip8*, chip8_savestate*);
+
+// Puts the machine back the way it was. Only the parts of memory that
+// could have changed are looked at to keep the backend caches right, and
+// only the screen rows that differ are marked dirty. Returns false, with
+// the machine untouched, if the state is from another version.
+bool chip8_restore(chip8*, const chip8_savestate*);
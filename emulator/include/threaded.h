@@ -0,0 +1,32 @@
+#pragma once
+
+// Optional faster interpreter.
+// Memory is decoded ahead of time into one chip8_instr per address, and
+// chip8_threaded_run jumps straight from one handler to the next
+// (computed goto on GCC/Clang, a plain switch everywhere else).
+// A few common sequences (a skip followed by a jump, setting up and drawing
+// a sprite) are fused at load time and run as one dispatch.
+// Writes to memory throw away the affected entries, so self-modifying
+// programs still behave.
+
+#include "chip8.h"
+#include "decode.h"
+
+struct chip8_cache {
+  chip8_instr code[CHIP8_MEM_SIZE];
+};
+
+// Allocates the cache and decodes the program area.
+bool chip8_threaded_enable(chip8*);
+void chip8_threaded_disable(chip8*);
+
+// Decode the program area again, e.g. after loading a new ROM.
+void chip8_threaded_reset(chip8*);
+
+// Forget whatever was decoded from the byte at addr.
+void chip8_cache_invalidate(struct chip8_cache*, word addr);
+
+// Runs up to `cycles` instructions, stopping early if the machine quits
+// or an instruction sets ch8->stop.
+// Returns how many instructions were executed.
+uint32_t chip8_threaded_run(chip8*, uint32_t cycles);
@@ -0,0 +1,206 @@
+// The threaded run loop for one profile, stamped out once per profile by
+// threaded.c the same way cores.c does with core.h:
+//
+//   #define CORE_NAME chip8_cosmac_
+//   #define CORE_QUIRKS CHIP8_QUIRKS_COSMAC
+//   #include "threaded_core.h"
+//
+// which defines chip8_cosmac_threaded_run.
+// Nothing else should include this.
+
+#define CORE_CAT_(a, b) a##b
+#define CORE_CAT(a, b) CORE_CAT_(a, b)
+#define CORE(name) CORE_CAT(CORE_NAME, name)
+
+static uint32_t CORE(threaded_run)(chip8 *ch8, uint32_t cycles) {
+  struct chip8_cache *cache = ch8->cache;
+  if (cache == NULL || ch8->quit) return 0;
+
+  const chip8_instr *in;
+  uint32_t left = cycles;
+
+  // NEXT: go straight to the next instruction's handler.
+  // NEXT_CHECKED: same, but for handlers that can stop the machine
+  // or ask chip8_run to return.
+#if CHIP8_COMPUTED_GOTO
+  static const void *labels[OP_MAX] = {
+    [CHIP8_OP_INVALID] = &&op_INVALID,
+    [CHIP8_OP_BREAK] = &&op_BREAK,
+    [CHIP8_OP_CLEAR] = &&op_CLEAR,
+    [CHIP8_OP_RETURN] = &&op_RETURN,
+    [CHIP8_OP_JUMP] = &&op_JUMP,
+    [CHIP8_OP_SUBROUTINE] = &&op_SUBROUTINE,
+    [CHIP8_OP_IFNEQ] = &&op_IFNEQ,
+    [CHIP8_OP_IFEQ] = &&op_IFEQ,
+    [CHIP8_OP_IFNEQ_R] = &&op_IFNEQ_R,
+    [CHIP8_OP_PIXEL] = &&op_PIXEL,
+    [CHIP8_OP_SET] = &&op_SET,
+    [CHIP8_OP_ADD] = &&op_ADD,
+    [CHIP8_OP_SET_R] = &&op_SET_R,
+    [CHIP8_OP_OR] = &&op_OR,
+    [CHIP8_OP_AND] = &&op_AND,
+    [CHIP8_OP_XOR] = &&op_XOR,
+    [CHIP8_OP_ADD_R] = &&op_ADD_R,
+    [CHIP8_OP_SUB] = &&op_SUB,
+    [CHIP8_OP_RSHIFT] = &&op_RSHIFT,
+    [CHIP8_OP_REVSUB] = &&op_REVSUB,
+    [CHIP8_OP_LSHIFT] = &&op_LSHIFT,
+    [CHIP8_OP_IFEQ_R] = &&op_IFEQ_R,
+    [CHIP8_OP_SET_I] = &&op_SET_I,
+    [CHIP8_OP_JUMP_R0] = &&op_JUMP_R0,
+    [CHIP8_OP_RANDOM] = &&op_RANDOM,
+    [CHIP8_OP_DRAW] = &&op_DRAW,
+    [CHIP8_OP_IFNKEY] = &&op_IFNKEY,
+    [CHIP8_OP_IFKEY] = &&op_IFKEY,
+    [CHIP8_OP_GET_TIMER] = &&op_GET_TIMER,
+    [CHIP8_OP_AWAIT] = &&op_AWAIT,
+    [CHIP8_OP_SET_TIMER] = &&op_SET_TIMER,
+    [CHIP8_OP_SET_SOUND] = &&op_SET_SOUND,
+    [CHIP8_OP_ADD_I] = &&op_ADD_I,
+    [CHIP8_OP_SETSPRITE] = &&op_SETSPRITE,
+    [CHIP8_OP_BCD] = &&op_BCD,
+    [CHIP8_OP_DUMP] = &&op_DUMP,
+    [CHIP8_OP_FILL] = &&op_FILL,
+    [OP_SLOW] = &&op_SLOW,
+    [OP_IFNEQ_JUMP] = &&op_IFNEQ_JUMP,
+    [OP_IFEQ_JUMP] = &&op_IFEQ_JUMP,
+    [OP_SET_SET_DRAW] = &&op_SET_SET_DRAW,
+    [OP_SET_I_DRAW] = &&op_SET_I_DRAW,
+  };
+
+  #define OP(NAME) op_##NAME:
+  #define FUSED(NAME) op_##NAME:
+  #define NEXT() do { \
+    if (left == 0) goto done; \
+    left--; \
+    in = chip8_cache_fetch(ch8, cache); \
+    goto *labels[in->op]; \
+  } while (0)
+
+  NEXT();
+#else
+  #define OP(NAME) case CHIP8_OP_##NAME:
+  #define FUSED(NAME) case OP_##NAME:
+  #define NEXT() continue
+
+  while (left > 0) {
+    left--;
+    in = chip8_cache_fetch(ch8, cache);
+    switch (in->op) {
+#endif
+
+  #define NEXT_CHECKED() { if (ch8->quit || ch8->stop) goto done; NEXT(); }
+
+  OP(INVALID) chip8_op_invalid(ch8, in); NEXT_CHECKED();
+  OP(BREAK) chip8_op_break(ch8, in); NEXT_CHECKED();
+  OP(CLEAR) chip8_op_clear(ch8, in); NEXT_CHECKED();
+  OP(RETURN) chip8_op_return(ch8, in); NEXT_CHECKED();
+  OP(JUMP) {
+    word from = ch8->PC;
+    chip8_op_jump(ch8, in);
+    left -= chip8_idle_after_jump(ch8, from, left);
+    NEXT();
+  }
+  OP(SUBROUTINE) chip8_op_subroutine(ch8, in); NEXT_CHECKED();
+  OP(IFNEQ) chip8_op_ifneq(ch8, in); NEXT();
+  OP(IFEQ) chip8_op_ifeq(ch8, in); NEXT();
+  OP(IFNEQ_R) chip8_op_ifneq_r(ch8, in); NEXT();
+  OP(PIXEL) chip8_op_pixel(ch8, in); NEXT_CHECKED();
+  OP(SET) chip8_op_set(ch8, in); NEXT();
+  OP(ADD) chip8_op_add(ch8, in); NEXT();
+  OP(SET_R) chip8_op_set_r(ch8, in); NEXT();
+  OP(OR) chip8_op_or(ch8, in); NEXT();
+  OP(AND) chip8_op_and(ch8, in); NEXT();
+  OP(XOR) chip8_op_xor(ch8, in); NEXT();
+  OP(ADD_R) chip8_op_add_r(ch8, in); NEXT();
+  OP(SUB) chip8_op_sub(ch8, in); NEXT();
+  OP(RSHIFT) chip8_op_rshift(ch8, in, CORE_QUIRKS); NEXT();
+  OP(REVSUB) chip8_op_revsub(ch8, in); NEXT();
+  OP(LSHIFT) chip8_op_lshift(ch8, in, CORE_QUIRKS); NEXT();
+  OP(IFEQ_R) chip8_op_ifeq_r(ch8, in); NEXT();
+  OP(SET_I) chip8_op_set_i(ch8, in); NEXT();
+  OP(JUMP_R0) chip8_op_jump_r0(ch8, in, CORE_QUIRKS); NEXT();
+  OP(RANDOM) chip8_op_random(ch8, in); NEXT();
+  OP(DRAW) chip8_op_draw(ch8, in, CORE_QUIRKS); NEXT_CHECKED();
+  OP(IFNKEY) chip8_op_ifnkey(ch8, in); NEXT();
+  OP(IFKEY) chip8_op_ifkey(ch8, in); NEXT();
+  OP(GET_TIMER) chip8_op_get_timer(ch8, in); NEXT();
+  OP(AWAIT) chip8_op_await(ch8, in); NEXT_CHECKED();
+  OP(SET_TIMER) chip8_op_set_timer(ch8, in); NEXT();
+  OP(SET_SOUND) chip8_op_set_sound(ch8, in); NEXT();
+  OP(ADD_I) chip8_op_add_i(ch8, in); NEXT();
+  OP(SETSPRITE) chip8_op_setsprite(ch8, in); NEXT();
+  OP(BCD) chip8_op_bcd(ch8, in); NEXT();
+  OP(DUMP) chip8_op_dump(ch8, in, CORE_QUIRKS); NEXT_CHECKED();
+  OP(FILL) chip8_op_fill(ch8, in, CORE_QUIRKS); NEXT_CHECKED();
+
+  // Superinstructions run the same handlers back to back, but only take
+  // as many instructions as are left. The rest of the sequence is
+  // still there, plain, for the next run.
+  // in+2 and in+4 are the cache entries for the following instructions.
+  FUSED(IFNEQ_JUMP) {
+    word pc = ch8->PC;
+    chip8_op_ifneq(ch8, in);
+    if (ch8->PC == pc+2 && left > 0) {
+      left--;
+      chip8_op_jump(ch8, in+2);
+      left -= chip8_idle_after_jump(ch8, pc+2, left);
+    }
+    NEXT();
+  }
+
+  FUSED(IFEQ_JUMP) {
+    word pc = ch8->PC;
+    chip8_op_ifeq(ch8, in);
+    if (ch8->PC == pc+2 && left > 0) {
+      left--;
+      chip8_op_jump(ch8, in+2);
+      left -= chip8_idle_after_jump(ch8, pc+2, left);
+    }
+    NEXT();
+  }
+
+  FUSED(SET_SET_DRAW) {
+    chip8_op_set(ch8, in);
+    if (left < 2) NEXT();
+    left -= 2;
+    chip8_op_set(ch8, in+2);
+    chip8_op_draw(ch8, in+4, CORE_QUIRKS);
+    NEXT_CHECKED();
+  }
+
+  FUSED(SET_I_DRAW) {
+    chip8_op_set_i(ch8, in);
+    if (left < 1) NEXT();
+    left--;
+    chip8_op_draw(ch8, in+2, CORE_QUIRKS);
+    NEXT_CHECKED();
+  }
+
+#if CHIP8_COMPUTED_GOTO
+  op_SLOW:
+#else
+      case OP_SLOW:
+      default:
+#endif
+  chip8_step(ch8); NEXT_CHECKED();
+
+#if !CHIP8_COMPUTED_GOTO
+    }
+  }
+#endif
+
+done:
+  #undef OP
+  #undef FUSED
+  #undef NEXT
+  #undef NEXT_CHECKED
+
+  return cycles - left;
+}
+
+#undef CORE_CAT_
+#undef CORE_CAT
+#undef CORE
+#undef CORE_NAME
+#undef CORE_QUIRKS
@@ -0,0 +1,55 @@
+#include "aot.h"
+#include "idle.h"
+
+#include <stddef.h>
+
+// has anything in [addr, addr+len) been written since the ROM was loaded?
+static bool chip8_aot_modified(chip8 *ch8, word addr, word len) {
+  for (word a=addr; a<addr+len; a=(a/64+1)*64) {
+    uint64_t bits = ch8->written[a / 64] >> (a % 64);
+    word span = 64 - a % 64;
+    if (addr+len-a < span) {
+      bits &= ((uint64_t)1 << (addr+len-a)) - 1;
+    }
+    if (bits != 0) return true;
+  }
+  return false;
+}
+
+void chip8_aot_enable(chip8 *ch8, const chip8_aot_block *blocks) {
+  ch8->aot = blocks;
+}
+
+void chip8_aot_disable(chip8 *ch8) {
+  ch8->aot = NULL;
+}
+
+uint32_t chip8_aot_run(chip8 *ch8, uint32_t cycles) {
+  const chip8_aot_block *blocks = ch8->aot;
+  if (blocks == NULL) return 0;
+
+  uint32_t left = cycles;
+  while (left > 0 && !ch8->quit && ch8->stop == CHIP8_STOP_NONE) {
+    word pc = ch8->PC;
+
+    const chip8_aot_block *b = NULL;
+    if (pc < CHIP8_MEM_SIZE && blocks[pc].fn != NULL) {
+      b = &blocks[pc];
+    }
+
+    if (b == NULL || b->len > left || chip8_aot_modified(ch8, pc, b->len*2)) {
+      chip8_step(ch8);
+      left--;
+      continue;
+    }
+
+    b->fn(ch8);
+    left -= b->len;
+    // did the block just go round an idle loop?
+    if (!ch8->quit && ch8->stop == CHIP8_STOP_NONE) {
+      left -= chip8_idle_after_jump(ch8, pc + 2*(b->len-1), left);
+    }
+  }
+
+  return cycles - left;
+}
@@ -1,22 +1,42 @@
 #include "chip8.h"
+#include "decode.h"
+#include "ops.h"
+#include "quirks.h"
+#include "threaded.h"
+#include "jit.h"
+#include "aot.h"
 
 #include "hexdata.h"
 
 #include <stdlib.h>
 #include <string.h>
 
-static void chip8_error(chip8 *ch8, const char *msg) {
+void chip8_error(chip8 *ch8, const char *msg) {
   strcpy(ch8->errormsg, msg);
   ch8->waserror = true;
   ch8->quit = true;
 }
 
-bool chip8_init(chip8 *ch8) {
-  ch8->mem = malloc(CHIP8_MEM_SIZE);
-  if (ch8->mem == NULL) {
-    chip8_error(ch8, "Failed to allocate memory");
-    return false;
+void *chip8_aligned_alloc(size_t size) {
+  // take a little extra and remember where the block started
+  void *block = malloc(size + 64 + sizeof(void*));
+  if (block == NULL) return NULL;
+
+  uintptr_t addr = ((uintptr_t)block + sizeof(void*) + 63) & ~(uintptr_t)63;
+  ((void**)addr)[-1] = block;
+  return (void*)addr;
+}
+
+void chip8_aligned_free(void *ptr) {
+  if (ptr != NULL) {
+    free(((void**)ptr)[-1]);
   }
+}
+
+bool chip8_init(chip8 *ch8) {
+  chip8_decode_init();
+
+  memset(ch8->mem, 0, CHIP8_MEM_SIZE);
 
   // hexadecimal number sprites
   memmove(ch8->mem, HEXDATA, 80);
@@ -24,6 +44,7 @@ bool chip8_init(chip8 *ch8) {
   for (int i=0; i<16; i++) {
     ch8->R[i] = 0;
   }
+  memset(ch8->stack, 0, sizeof(ch8->stack));
 
   ch8->I = 0;
   ch8->SP = 0;
@@ -32,11 +53,12 @@ bool chip8_init(chip8 *ch8) {
   ch8->timer = 0;
   ch8->sound = 0;
 
-  for (int i=0; i<CHIP8_SCREEN_W; i++) {
-    for (int j=0; j<CHIP8_SCREEN_H; j++) {
-      ch8->screen[i][j] = false;
-    }
-  }
+  chip8_seed(ch8, CHIP8_DEFAULT_SEED);
+
+  memset(ch8->screen, 0, sizeof(ch8->screen));
+  // nothing has shown it yet
+  ch8->dirty_rows = ~(uint32_t)0;
+  ch8->screen_changed = true;
 
   for (int i=0; i<16; i++) {
     ch8->keys[i] = false;
@@ -44,18 +66,37 @@ bool chip8_init(chip8 *ch8) {
 
   ch8->quit = false;
 
+  ch8->core = &chip8_cores[CHIP8_PROFILE_DEFAULT];
+
   ch8->waserror = false;
 
+  ch8->stop = CHIP8_STOP_NONE;
+  ch8->cycles = 0;
+  ch8->ticks = 0;
+  ch8->cycles_per_tick = CHIP8_DEFAULT_CYCLES_PER_TICK;
+  ch8->tick_cycles_left = CHIP8_DEFAULT_CYCLES_PER_TICK;
+  ch8->idle_cycles = 0;
+
+  memset(ch8->written, 0, sizeof(ch8->written));
+
+  ch8->cache = NULL;
+  ch8->jit = NULL;
+  ch8->aot = NULL;
+
   return true;
 }
 
 void chip8_quit(chip8 *ch8) {
-  free(ch8->mem);
+  chip8_threaded_disable(ch8);
+  chip8_jit_disable(ch8);
 }
 
-bool chip8_loadrom(chip8 *ch8, byte *rom, long length) {
+bool chip8_loadrom(chip8 *ch8, const byte *rom, long length) {
   if (length < CHIP8_MEM_SIZE - CHIP8_PROGRAM_START_ADDRESS) {
     memmove(ch8->mem+CHIP8_PROGRAM_START_ADDRESS, rom, length);
+    memset(ch8->written, 0, sizeof(ch8->written));
+    chip8_threaded_reset(ch8);
+    chip8_jit_reset(ch8);
     return true;
   } else {
     chip8_error(ch8, "Loaded ROM is too big");
@@ -63,6 +104,7 @@ bool chip8_loadrom(chip8 *ch8, byte *rom, long length) {
   }
 }
 
+#ifdef CHIP8_CHECKED_MEMORY
 byte chip8_read(chip8 *ch8, word addr) {
   if (addr >= CHIP8_MEM_SIZE) {
     chip8_error(ch8, "Out-of-bounds memory read");
@@ -71,70 +113,63 @@ byte chip8_read(chip8 *ch8, word addr) {
     return ch8->mem[addr];
   }
 }
+#endif
 
 void chip8_write(chip8 *ch8, word addr, byte value) {
+#ifdef CHIP8_CHECKED_MEMORY
   if (addr >= CHIP8_MEM_SIZE) {
     chip8_error(ch8, "Out-of-bounds memory write");
-  } else {
-    ch8->mem[addr] = value;
+    return;
   }
+#else
+  addr &= CHIP8_ADDR_MASK;
+#endif
+
+  ch8->mem[addr] = value;
+  ch8->written[addr / 64] |= (uint64_t)1 << (addr % 64);
+  if (ch8->cache != NULL) chip8_cache_invalidate(ch8->cache, addr);
+  if (ch8->jit != NULL) chip8_jit_invalidate(ch8->jit, addr);
 }
 
-static void chip8_advance(chip8 *ch8) {
-  ch8->PC += 2;
+void chip8_set_profile(chip8 *ch8, chip8_profile profile) {
+  ch8->core = &chip8_cores[profile];
+  // anything already translated has the old quirks baked in
+  chip8_threaded_reset(ch8);
+  chip8_jit_reset(ch8);
 }
 
-static void chip8_clear(chip8 *ch8) {
-  for (int i=0; i<CHIP8_SCREEN_W; i++) {
-    for (int j=0; j<CHIP8_SCREEN_H; j++) {
-      ch8->screen[i][j] = false;
-    }
-  }
+void chip8_seed(chip8 *ch8, uint64_t seed) {
+  // one round of splitmix64, so similar seeds still start far apart
+  uint64_t z = seed + 0x9E3779B97F4A7C15;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+  z ^= z >> 31;
+  // xorshift gets stuck on 0
+  ch8->rng = z != 0 ? z : 0x9E3779B97F4A7C15;
 }
 
-static void chip8_jump(chip8 *ch8, word destination) {
-  ch8->PC = destination;
-}
-
-static void chip8_subroutine(chip8 *ch8, word destination) {
-  ch8->stack[ch8->SP] = ch8->PC;
-  ch8->SP++;
-  ch8->PC = destination;
-}
-
-static void chip8_return(chip8 *ch8) {
-  if (ch8->SP == 0) {
-    chip8_error(ch8, "Stack underflow");
-  } else if (ch8->SP >= CHIP8_STACK_SIZE) {
-    chip8_error(ch8, "Stack overflow");
-  } else {
-    ch8->SP--;
-    ch8->PC = ch8->stack[ch8->SP];
-    chip8_advance(ch8);
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t size) {
+  const byte *p = data;
+  for (size_t i=0; i<size; i++) {
+    h = (h ^ p[i]) * 0x100000001B3;
   }
+  return h;
 }
 
-static void chip8_pixel(chip8 *ch8, byte x, byte y) {
-  if (x < CHIP8_SCREEN_W && y < CHIP8_SCREEN_H)
-    ch8->screen[x][y] = !ch8->screen[x][y];
-}
-
-static void chip8_draw(chip8 *ch8, byte x, byte y, byte height) {
-
-  word addr = ch8->I;
-
-  bool bits[8];
-  for (int i=0; i<height; i++) {
-    for (int b=7; b>=0; b--) {
-      bits[b] = (chip8_read(ch8, addr+i) & (128>>b)) != 0;
-    }
-
-    for (int j=0; j<8; j++) {
-      if (x+j < CHIP8_SCREEN_W && y+i < CHIP8_SCREEN_H)
-        ch8->screen[x+j][y+i] ^= bits[j];
-    }
-  }
-
+uint64_t chip8_hash(const chip8 *ch8) {
+  uint64_t h = 0xCBF29CE484222325;
+  h = hash_bytes(h, ch8->R, sizeof(ch8->R));
+  h = hash_bytes(h, &ch8->I, sizeof(ch8->I));
+  h = hash_bytes(h, &ch8->SP, sizeof(ch8->SP));
+  // only the live part, the rest is left over from earlier calls
+  h = hash_bytes(h, ch8->stack, (ch8->SP < CHIP8_STACK_SIZE ? ch8->SP : CHIP8_STACK_SIZE) * sizeof(word));
+  h = hash_bytes(h, &ch8->PC, sizeof(ch8->PC));
+  h = hash_bytes(h, &ch8->timer, sizeof(ch8->timer));
+  h = hash_bytes(h, &ch8->sound, sizeof(ch8->sound));
+  h = hash_bytes(h, &ch8->rng, sizeof(ch8->rng));
+  h = hash_bytes(h, ch8->mem, sizeof(ch8->mem));
+  h = hash_bytes(h, ch8->screen, sizeof(ch8->screen));
+  return h;
 }
 
 void chip8_timer_tick(chip8 *ch8) {
@@ -143,346 +178,65 @@ void chip8_timer_tick(chip8 *ch8) {
 }
 
 void chip8_step(chip8 *ch8) {
+  // the decode table already has the operands pulled apart,
+  // so all that's left is to call the right handler
+  const chip8_instr *in = chip8_fetch(ch8);
+  ch8->core->handlers[in->op](ch8, in);
+}
 
-  // get current instruction
-  byte high, low;
-  high = chip8_read(ch8, ch8->PC);
-  low = chip8_read(ch8, (ch8->PC)+1);
-  // the whole 2-byte instruction
-  word w = (high << 8) | low;
-
-  // common instruction parts
-  // Register X: 0X00
-  byte x = high & 0x0F;
-  // Register Y: 00Y0
-  byte y = (low & 0xF0) >> 4;
-  // Destination (or other 1.5 byte value): 0NNN
-  word destination = w & 0x0FFF;
-
-  byte firstnibble = (high & 0xF0) >> 4;
-  byte lastnibble = (low & 0x0F);
-  switch (firstnibble) {
-
-    case 0x0: {
-
-      if (w == 0x0000) {
-        // 0000 NON-STANDARD: BREAK
-        ch8->quit = true;
-        return;
-      } else if (w == 0x00E0) {
-        // 00E0: CLEAR
-        chip8_clear(ch8);
-        chip8_advance(ch8);
-      } else if (w == 0x00EE) {
-        // 00EE: RETURN
-        chip8_return(ch8);
-
-      } else {
-        chip8_error(ch8, "Invalid instruction");
-        return;
-      }
-
-      break;
-    }
-
-    case 0x1: {
-      // 1NNN: JUMP
-      chip8_jump(ch8, destination);
-      break;
-    }
-
-    case 0x2: {
-      // 2NNN: SUBROUTINE
-      chip8_subroutine(ch8, destination);
-      break;
-    }
-
-    case 0x3: {
-      // 3XNN: IFNEQ (SKIP NEXT IF RX = NN)
-      if (ch8->R[x] == low) {
-        chip8_advance(ch8);
-      }
-      chip8_advance(ch8);
-      break;
-    }
-
-    case 0x4: {
-      // 4XNN: IFEQ (SKIP NEXT IF RX != NN)
-      if (ch8->R[x] != low) {
-        chip8_advance(ch8);
-      }
-      chip8_advance(ch8);
-      break;
-    }
-
-    case 0x5: {
-
-      if (lastnibble == 0x0) {
-        // 5XY0: IFNEQ (SKIP NEXT IF RX = RY)
-        if (ch8->R[x] == ch8->R[y]) {
-          chip8_advance(ch8);
-        }
-        chip8_advance(ch8);
-      } else if (lastnibble == 0x1) {
-        // 5XY1 NON-STANDARD: PIXEL
-        chip8_pixel(ch8, ch8->R[x], ch8->R[y]);
-        chip8_advance(ch8);
-      } else {
-        chip8_error(ch8, "Invalid instruction");
-        return;
-      }
-      break;
-    }
-
-    case 0x6: {
-      // 6XNN: SET RX, NN
-      ch8->R[x] = low;
-      chip8_advance(ch8);
-      break;
-    }
-
-    case 0x7: {
-      // 7XNN: ADD RX, NN
-      ch8->R[x] += low; // no carry flag change!
-      chip8_advance(ch8);
-      break;
-    }
-
-    case 0x8: {
-      switch (lastnibble) {
-        case 0x0: {
-          // 8XY0: SET RX, RY
-          ch8->R[x] = ch8->R[y];
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x1: {
-          // 8XY1: OR RX, RY
-          ch8->R[x] |= ch8->R[y];
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x2: {
-          // 8XY2: AND RX, RY
-          ch8->R[x] &= ch8->R[y];
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x3: {
-          // 8XY3: XOR RX, RY
-          ch8->R[x] ^= ch8->R[y];
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x4: {
-          // 8XY4: ADD RX, RY
-          // set RF if overflow
-          if (ch8->R[x] + ch8->R[y] > 255)
-            ch8->R[0xF] = 1;
-          else
-            ch8->R[0xF] = 0;
-            
-          ch8->R[x] += ch8->R[y];
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x5: {
-          // 8XY5: SUB RX, RY
-          // set RF if no borrow
-          if (ch8->R[x] >= ch8->R[y])
-            ch8->R[0xF] = 1;
-          else
-            ch8->R[0xF] = 0;
-
-          ch8->R[x] -= ch8->R[y];
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x6: {
-          // 8XY6: RSHIFT RX
-          // set RF to RX's LSB
-          ch8->R[0xF] = ch8->R[x] & 0x01;
-          ch8->R[x] >>= 1;
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x7: {
-          // 8XY7: REVSUB RX, RY
-          if (ch8->R[x] > ch8->R[y])
-            ch8->R[0xF] = 1;
-          else
-            ch8->R[0xF] = 0;
-
-          ch8->R[x] = ch8->R[y] - ch8->R[x];
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0xE: {
-          // 8XYE: LSHIFT RX
-          ch8->R[0xF] = (ch8->R[x] & 128) >> 7;
-          ch8->R[x] <<= 1;
-          chip8_advance(ch8);
-          break;
-        }
-
-        default: {
-          chip8_error(ch8, "Invalid instruction");
-          return;
-        }
-      }
-      break;
-    }
-
-    case 0x9: {
-      if (lastnibble == 0x0) {
-        // 9XY0: IFEQ RX, RY (SKIP NEXT IF RX != RY)
-        if (ch8->R[x] != ch8->R[y]) {
-          chip8_advance(ch8);
-        }
-        chip8_advance(ch8);
-      } else {
-        chip8_error(ch8, "Invalid instruction");
-        return;
-      }
-      break;
-    }
-
-    case 0xA: {
-      // ANNN: SET I, NNN
-      ch8->I = destination;
-      chip8_advance(ch8);
-      break;
-    }
+void chip8_set_cycles_per_tick(chip8 *ch8, uint32_t cycles_per_tick) {
+  if (cycles_per_tick == 0) cycles_per_tick = 1;
+  ch8->cycles_per_tick = cycles_per_tick;
+  if (ch8->tick_cycles_left > cycles_per_tick) {
+    ch8->tick_cycles_left = cycles_per_tick;
+  }
+}
 
-    case 0xB: {
-      // BNNN: JUMP NNN, R0 (NNN + R0)
-      chip8_jump(ch8, destination + ch8->R[0]);
-      break;
-    }
+// Moves the virtual clock on by n cycles, ticking the timers on the way.
+static void chip8_clock_advance(chip8 *ch8, uint32_t n) {
+  ch8->cycles += n;
+  while (n >= ch8->tick_cycles_left) {
+    n -= ch8->tick_cycles_left;
+    chip8_timer_tick(ch8);
+    ch8->ticks++;
+    ch8->tick_cycles_left = ch8->cycles_per_tick;
+  }
+  ch8->tick_cycles_left -= n;
+}
 
-    case 0xC: {
-      // CXNN: RANDOM RX, NN (RX = RANDOM BYTE & NN)
-      ch8->R[x] = (rand() % 255) & low;
-      chip8_advance(ch8);
-      break;
-    }
+static uint32_t chip8_run_backend(chip8 *ch8, uint32_t cycles) {
+  if (ch8->aot != NULL) return chip8_aot_run(ch8, cycles);
+  if (ch8->jit != NULL) return chip8_jit_run(ch8, cycles);
+  if (ch8->cache != NULL) return chip8_threaded_run(ch8, cycles);
+  return ch8->core->run(ch8, cycles);
+}
 
-    case 0xD: {
-      // DXYN: DRAW RX, RY, N
-      chip8_draw(ch8, ch8->R[x], ch8->R[y], lastnibble);
-      chip8_advance(ch8);
-      break;
-    }
+chip8_stop chip8_run(chip8 *ch8, uint32_t max_cycles) {
+  ch8->stop = CHIP8_STOP_NONE;
 
-    case 0xE: {
-      if (low == 0x9E) {
-        // EX9E: IFNKEY RX (SKIP NEXT IF KEY IN RX IS PRESSED)
-        byte key = ch8->R[x] & 0x0F;
-        if (ch8->keys[key]) {
-          chip8_advance(ch8);
-        }
-        chip8_advance(ch8);
-      } else if (low == 0xA1) {
-        // EX9E: IFKEY RX (SKIP NEXT IF KEY IN RX IS NOT PRESSED)
-        byte key = ch8->R[x] & 0x0F;
-        if (!ch8->keys[key]) {
-          chip8_advance(ch8);
-        }
-        chip8_advance(ch8);
-      } else {
-        chip8_error(ch8, "Invalid instruction");
-        return;
-      }
-      break;
-    }
+  uint32_t ran = 0;
+  while (ran < max_cycles && !ch8->quit && ch8->stop == CHIP8_STOP_NONE) {
+    // never run past a tick, the next instruction might read the timer
+    uint32_t budget = max_cycles - ran;
+    if (budget > ch8->tick_cycles_left) budget = ch8->tick_cycles_left;
 
-    case 0xF: {
-      switch (low) {
-        case 0x07: {
-          // FX07: SET RX, TIMER
-          ch8->R[x] = ch8->timer;
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x0A: {
-          // FX0A: AWAIT KEYPRESS
-          //todo
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x15: {
-          // FX15: SET TIMER, RX
-          ch8->timer = ch8->R[x];
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x18: {
-          // FX18: SET SOUND, RX
-          ch8->sound = ch8->R[x];
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x1E: {
-          // FX1E: ADD I, RX
-          ch8->I += ch8->R[x];
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x29: {
-          // FX29: SETSPRITE RX
-          ch8->I = (ch8->R[x] & 0x0F) * 5;
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x33: {
-          // FX33: BCD RX
-          //todo
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x55: {
-          // FX55: DUMP RX
-          for (int i=0; i<=x; i++) {
-            ch8->mem[i+ch8->I] = ch8->R[i];
-          }
-          chip8_advance(ch8);
-          break;
-        }
-
-        case 0x65: {
-          // FX65: FILL RX
-          for (int i=0; i<=x; i++) {
-            ch8->mem[i+ch8->I] = ch8->R[i];
-          }
-          chip8_advance(ch8);
-          break;
-        }
-
-        default: {
-          chip8_error(ch8, "Invalid instruction");
-          return;
-        }
-      }
-      break;
+    uint32_t n = chip8_run_backend(ch8, budget);
+    if (ch8->stop == CHIP8_STOP_KEYWAIT) {
+      // FX0A would spin for the rest of the time
+      n = max_cycles - ran;
     }
-
-
+    chip8_clock_advance(ch8, n);
+    ran += n;
   }
 
+  if (ch8->waserror) return CHIP8_STOP_ERROR;
+  if (ch8->quit) return CHIP8_STOP_QUIT;
+  return ch8->stop;
+}
 
+void chip8_run_frame(chip8 *ch8) {
+  uint64_t tick = ch8->ticks;
+  while (!ch8->quit && ch8->ticks == tick) {
+    chip8_run(ch8, chip8_cycles_until_tick(ch8));
+  }
 }
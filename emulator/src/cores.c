@@ -0,0 +1,24 @@
+#include "quirks.h"
+
+#define CORE_NAME chip8_default_
+#define CORE_QUIRKS CHIP8_QUIRKS_DEFAULT
+#include "core.h"
+
+#define CORE_NAME chip8_cosmac_
+#define CORE_QUIRKS CHIP8_QUIRKS_COSMAC
+#include "core.h"
+
+#define CORE_NAME chip8_schip_
+#define CORE_QUIRKS CHIP8_QUIRKS_SCHIP
+#include "core.h"
+
+#define CORE_NAME chip8_xochip_
+#define CORE_QUIRKS CHIP8_QUIRKS_XOCHIP
+#include "core.h"
+
+const chip8_core chip8_cores[CHIP8_PROFILE_COUNT] = {
+  [CHIP8_PROFILE_DEFAULT] = { CHIP8_QUIRKS_DEFAULT, chip8_default_handlers, chip8_default_run },
+  [CHIP8_PROFILE_COSMAC] = { CHIP8_QUIRKS_COSMAC, chip8_cosmac_handlers, chip8_cosmac_run },
+  [CHIP8_PROFILE_SCHIP] = { CHIP8_QUIRKS_SCHIP, chip8_schip_handlers, chip8_schip_run },
+  [CHIP8_PROFILE_XOCHIP] = { CHIP8_QUIRKS_XOCHIP, chip8_xochip_handlers, chip8_xochip_run },
+};
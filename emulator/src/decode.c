@@ -0,0 +1,102 @@
+#include "decode.h"
+
+chip8_instr chip8_decode_table[0x10000];
+
+static bool decode_table_ready = false;
+
+static byte chip8_decode_op(word w) {
+  byte low = w & 0xFF;
+  byte lastnibble = w & 0x000F;
+
+  switch ((w & 0xF000) >> 12) {
+    case 0x0: {
+      if (w == 0x0000) return CHIP8_OP_BREAK;
+      if (w == 0x00E0) return CHIP8_OP_CLEAR;
+      if (w == 0x00EE) return CHIP8_OP_RETURN;
+      return CHIP8_OP_INVALID;
+    }
+
+    case 0x1: return CHIP8_OP_JUMP;
+    case 0x2: return CHIP8_OP_SUBROUTINE;
+    case 0x3: return CHIP8_OP_IFNEQ;
+    case 0x4: return CHIP8_OP_IFEQ;
+
+    case 0x5: {
+      if (lastnibble == 0x0) return CHIP8_OP_IFNEQ_R;
+      if (lastnibble == 0x1) return CHIP8_OP_PIXEL;
+      return CHIP8_OP_INVALID;
+    }
+
+    case 0x6: return CHIP8_OP_SET;
+    case 0x7: return CHIP8_OP_ADD;
+
+    case 0x8: {
+      switch (lastnibble) {
+        case 0x0: return CHIP8_OP_SET_R;
+        case 0x1: return CHIP8_OP_OR;
+        case 0x2: return CHIP8_OP_AND;
+        case 0x3: return CHIP8_OP_XOR;
+        case 0x4: return CHIP8_OP_ADD_R;
+        case 0x5: return CHIP8_OP_SUB;
+        case 0x6: return CHIP8_OP_RSHIFT;
+        case 0x7: return CHIP8_OP_REVSUB;
+        case 0xE: return CHIP8_OP_LSHIFT;
+        default: return CHIP8_OP_INVALID;
+      }
+    }
+
+    case 0x9: {
+      if (lastnibble == 0x0) return CHIP8_OP_IFEQ_R;
+      return CHIP8_OP_INVALID;
+    }
+
+    case 0xA: return CHIP8_OP_SET_I;
+    case 0xB: return CHIP8_OP_JUMP_R0;
+    case 0xC: return CHIP8_OP_RANDOM;
+    case 0xD: return CHIP8_OP_DRAW;
+
+    case 0xE: {
+      if (low == 0x9E) return CHIP8_OP_IFNKEY;
+      if (low == 0xA1) return CHIP8_OP_IFKEY;
+      return CHIP8_OP_INVALID;
+    }
+
+    case 0xF: {
+      switch (low) {
+        case 0x07: return CHIP8_OP_GET_TIMER;
+        case 0x0A: return CHIP8_OP_AWAIT;
+        case 0x15: return CHIP8_OP_SET_TIMER;
+        case 0x18: return CHIP8_OP_SET_SOUND;
+        case 0x1E: return CHIP8_OP_ADD_I;
+        case 0x29: return CHIP8_OP_SETSPRITE;
+        case 0x33: return CHIP8_OP_BCD;
+        case 0x55: return CHIP8_OP_DUMP;
+        case 0x65: return CHIP8_OP_FILL;
+        default: return CHIP8_OP_INVALID;
+      }
+    }
+  }
+
+  return CHIP8_OP_INVALID;
+}
+
+chip8_instr chip8_decode(word w) {
+  chip8_instr in;
+  in.op = chip8_decode_op(w);
+  in.x = (w & 0x0F00) >> 8;
+  in.y = (w & 0x00F0) >> 4;
+  in.n = w & 0x000F;
+  in.nn = w & 0x00FF;
+  in.nnn = w & 0x0FFF;
+  return in;
+}
+
+void chip8_decode_init(void) {
+  if (decode_table_ready) return;
+
+  for (uint i=0; i<0x10000; i++) {
+    chip8_decode_table[i] = chip8_decode(i);
+  }
+
+  decode_table_ready = true;
+}
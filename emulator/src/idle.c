@@ -0,0 +1,66 @@
+#include "idle.h"
+#include "decode.h"
+
+#include <string.h>
+
+// Runs one instruction on a copy of the registers, if it's one that can
+// be part of an idle loop: jumps, skips, and setting registers from the
+// timer or constants. Nothing else is touched.
+static bool idle_step(const chip8 *ch8, byte R[16], word *pc) {
+  if (*pc >= CHIP8_MEM_SIZE-1) return false;
+  const chip8_instr *in = &chip8_decode_table[(ch8->mem[*pc] << 8) | ch8->mem[*pc+1]];
+
+  bool skip = false;
+  switch (in->op) {
+    case CHIP8_OP_JUMP: *pc = in->nnn; return true;
+    case CHIP8_OP_IFNEQ: skip = R[in->x] == in->nn; break;
+    case CHIP8_OP_IFEQ: skip = R[in->x] != in->nn; break;
+    case CHIP8_OP_IFNEQ_R: skip = R[in->x] == R[in->y]; break;
+    case CHIP8_OP_IFEQ_R: skip = R[in->x] != R[in->y]; break;
+    case CHIP8_OP_IFNKEY: skip = ch8->keys[R[in->x] & 0x0F]; break;
+    case CHIP8_OP_IFKEY: skip = !ch8->keys[R[in->x] & 0x0F]; break;
+    case CHIP8_OP_GET_TIMER: R[in->x] = ch8->timer; break;
+    case CHIP8_OP_SET: R[in->x] = in->nn; break;
+    case CHIP8_OP_SET_R: R[in->x] = R[in->y]; break;
+    default: return false;
+  }
+  *pc += skip ? 4 : 2;
+  return true;
+}
+
+// Goes round once from PC. Returns how many instructions it took to get
+// back to PC, or 0 if it left the loop or did something else.
+static uint32_t idle_round(const chip8 *ch8, byte R[16]) {
+  word pc = ch8->PC;
+  for (uint32_t len=1; len<=CHIP8_IDLE_MAX_LOOP; len++) {
+    if (!idle_step(ch8, R, &pc)) return 0;
+    if (pc == ch8->PC) return len;
+  }
+  return 0;
+}
+
+uint32_t chip8_idle_skip(chip8 *ch8, uint32_t budget) {
+  byte first[16];
+  memcpy(first, ch8->R, sizeof(first));
+  uint32_t len = idle_round(ch8, first);
+  if (len == 0 || len > budget) return 0;
+
+  if (memcmp(first, ch8->R, sizeof(first)) == 0) {
+    // every time round is the same as this one
+    uint32_t skipped = budget / len * len;
+    ch8->idle_cycles += skipped;
+    return skipped;
+  }
+
+  // The first time round changes a register (say the timer's new value
+  // is read), so it's only idle if the second time doesn't.
+  byte second[16];
+  memcpy(second, first, sizeof(second));
+  uint32_t len2 = idle_round(ch8, second);
+  if (len2 == 0 || memcmp(second, first, sizeof(second)) != 0) return 0;
+
+  memcpy(ch8->R, first, sizeof(first));
+  uint32_t skipped = len + (budget - len) / len2 * len2;
+  ch8->idle_cycles += skipped;
+  return skipped;
+}
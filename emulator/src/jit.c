@@ -0,0 +1,472 @@
+#include "jit.h"
+#include "decode.h"
+#include "ops.h"
+#include "idle.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define JIT_CODE_SIZE (1024 * 1024)
+#define JIT_MAX_BLOCK 64 // instructions
+#define JIT_MAX_INSTR_BYTES 64
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK * JIT_MAX_INSTR_BYTES + 64)
+
+typedef void (*chip8_block_fn)(chip8*);
+
+typedef struct {
+  chip8_block_fn fn; // NULL if not translated yet
+  word len;          // number of instructions
+} chip8_block;
+
+struct chip8_jit {
+  byte *code;
+  uint32_t used;
+
+  // indexed by guest start address
+  chip8_block blocks[CHIP8_MEM_SIZE];
+  // true for every byte that some block was translated from
+  bool covered[CHIP8_MEM_SIZE];
+};
+
+// Inside a block rbx always holds the chip8 pointer.
+// Guest registers are read and written in place ([rbx + offset]),
+// and PC is only stored when the block exits, since it's known at
+// translation time for every instruction.
+
+#define OFS_R(x) ((int32_t)(offsetof(chip8, R) + (x)))
+#define OFS_I ((int32_t)offsetof(chip8, I))
+#define OFS_PC ((int32_t)offsetof(chip8, PC))
+#define OFS_TIMER ((int32_t)offsetof(chip8, timer))
+#define OFS_SOUND ((int32_t)offsetof(chip8, sound))
+#define OFS_KEYS ((int32_t)offsetof(chip8, keys))
+
+typedef struct {
+  byte *p;
+  // the profile being compiled for
+  const chip8_core *core;
+} emitter;
+
+static void emit(emitter *e, byte b) {
+  *e->p++ = b;
+}
+
+static void emit16(emitter *e, uint16_t v) {
+  emit(e, v & 0xFF);
+  emit(e, v >> 8);
+}
+
+static void emit32(emitter *e, uint32_t v) {
+  for (int i=0; i<4; i++) emit(e, (v >> (i*8)) & 0xFF);
+}
+
+static void emit64(emitter *e, uint64_t v) {
+  for (int i=0; i<8; i++) emit(e, (v >> (i*8)) & 0xFF);
+}
+
+// ModRM for [rbx + disp32], with `reg` in the reg field
+static void emit_mem(emitter *e, byte reg, int32_t disp) {
+  emit(e, 0x80 | (reg << 3) | 0x03);
+  emit32(e, (uint32_t)disp);
+}
+
+// mov byte [m], imm8
+static void emit_mov_m8_imm(emitter *e, int32_t disp, byte v) {
+  emit(e, 0xC6); emit_mem(e, 0, disp); emit(e, v);
+}
+
+// mov word [m], imm16
+static void emit_mov_m16_imm(emitter *e, int32_t disp, word v) {
+  emit(e, 0x66); emit(e, 0xC7); emit_mem(e, 0, disp); emit16(e, v);
+}
+
+// mov al, [m]
+static void emit_load_al(emitter *e, int32_t disp) {
+  emit(e, 0x8A); emit_mem(e, 0, disp);
+}
+
+// mov [m], al
+static void emit_store_al(emitter *e, int32_t disp) {
+  emit(e, 0x88); emit_mem(e, 0, disp);
+}
+
+// movzx eax, byte [m]
+static void emit_movzx_eax(emitter *e, int32_t disp) {
+  emit(e, 0x0F); emit(e, 0xB6); emit_mem(e, 0, disp);
+}
+
+static void emit_prologue(emitter *e) {
+  emit(e, 0x53);                                  // push rbx
+#if defined(_WIN32)
+  emit(e, 0x48); emit(e, 0x89); emit(e, 0xCB);    // mov rbx, rcx
+  emit(e, 0x48); emit(e, 0x83); emit(e, 0xEC); emit(e, 0x20); // sub rsp, 32
+#else
+  emit(e, 0x48); emit(e, 0x89); emit(e, 0xFB);    // mov rbx, rdi
+#endif
+}
+
+static void emit_epilogue(emitter *e) {
+#if defined(_WIN32)
+  emit(e, 0x48); emit(e, 0x83); emit(e, 0xC4); emit(e, 0x20); // add rsp, 32
+#endif
+  emit(e, 0x5B);                                  // pop rbx
+  emit(e, 0xC3);                                  // ret
+}
+
+// handler(ch8, in)
+static void emit_call_handler(emitter *e, const chip8_instr *in) {
+#if defined(_WIN32)
+  emit(e, 0x48); emit(e, 0x89); emit(e, 0xD9);    // mov rcx, rbx
+  emit(e, 0x48); emit(e, 0xBA);                   // mov rdx, imm64
+#else
+  emit(e, 0x48); emit(e, 0x89); emit(e, 0xDF);    // mov rdi, rbx
+  emit(e, 0x48); emit(e, 0xBE);                   // mov rsi, imm64
+#endif
+  emit64(e, (uint64_t)(uintptr_t)in);
+  emit(e, 0x48); emit(e, 0xB8);                   // mov rax, imm64
+  emit64(e, (uint64_t)(uintptr_t)e->core->handlers[in->op]);
+  emit(e, 0xFF); emit(e, 0xD0);                   // call rax
+}
+
+// PC = addr+2, or addr+4 unless the flags say "don't skip" (jcc)
+static void emit_skip(emitter *e, byte jcc, word addr) {
+  emit(e, jcc); emit(e, 9);                       // jcc over the next mov
+  emit_mov_m16_imm(e, OFS_PC, addr+4);
+}
+
+// Translates one instruction. Returns true if it ends the block.
+static bool emit_instr(emitter *e, const chip8_instr *in, word addr) {
+  byte x = in->x, y = in->y;
+
+  switch (in->op) {
+    case CHIP8_OP_SET: {
+      emit_mov_m8_imm(e, OFS_R(x), in->nn);
+      return false;
+    }
+
+    case CHIP8_OP_ADD: {
+      emit(e, 0x80); emit_mem(e, 0, OFS_R(x)); emit(e, in->nn); // add byte [Rx], nn
+      return false;
+    }
+
+    case CHIP8_OP_SET_R: {
+      emit_load_al(e, OFS_R(y));
+      emit_store_al(e, OFS_R(x));
+      return false;
+    }
+
+    case CHIP8_OP_OR:
+    case CHIP8_OP_AND:
+    case CHIP8_OP_XOR: {
+      byte opc = in->op == CHIP8_OP_OR ? 0x08 : in->op == CHIP8_OP_AND ? 0x20 : 0x30;
+      emit_load_al(e, OFS_R(y));
+      emit(e, opc); emit_mem(e, 0, OFS_R(x));     // op [Rx], al
+      return false;
+    }
+
+    case CHIP8_OP_ADD_R: {
+      // RF first, from the old values, then the add itself (RF may be X or Y)
+      emit_movzx_eax(e, OFS_R(x));
+      emit(e, 0x0F); emit(e, 0xB6); emit_mem(e, 1, OFS_R(y)); // movzx ecx, byte [Ry]
+      emit(e, 0x01); emit(e, 0xC8);               // add eax, ecx
+      emit(e, 0x3D); emit32(e, 255);              // cmp eax, 255
+      emit(e, 0x0F); emit(e, 0x97); emit(e, 0xC0); // seta al
+      emit_store_al(e, OFS_R(0xF));
+      emit_load_al(e, OFS_R(x));
+      emit(e, 0x02); emit_mem(e, 0, OFS_R(y));    // add al, [Ry]
+      emit_store_al(e, OFS_R(x));
+      return false;
+    }
+
+    case CHIP8_OP_SUB:
+    case CHIP8_OP_REVSUB: {
+      bool rev = in->op == CHIP8_OP_REVSUB;
+      emit_load_al(e, OFS_R(x));
+      emit(e, 0x3A); emit_mem(e, 0, OFS_R(y));    // cmp al, [Ry]
+      // SUB: RF = RX >= RY, REVSUB: RF = RX > RY
+      emit(e, 0x0F); emit(e, rev ? 0x97 : 0x93); emit(e, 0xC0); // seta/setae al
+      emit_store_al(e, OFS_R(0xF));
+      // SUB: RX = RX - RY, REVSUB: RX = RY - RX
+      emit_load_al(e, OFS_R(rev ? y : x));
+      emit(e, 0x2A); emit_mem(e, 0, OFS_R(rev ? x : y)); // sub al, [..]
+      emit_store_al(e, OFS_R(x));
+      return false;
+    }
+
+    case CHIP8_OP_RSHIFT: {
+      byte src = (e->core->quirks & CHIP8_QUIRK_SHIFT_VY) ? y : x;
+      // re-read the source after setting RF like ops.h, so 8XF6 agrees
+      emit_load_al(e, OFS_R(src));
+      emit(e, 0x24); emit(e, 0x01);               // and al, 1
+      emit_store_al(e, OFS_R(0xF));
+      emit_load_al(e, OFS_R(src));
+      emit(e, 0xD0); emit(e, 0xE8);               // shr al, 1
+      emit_store_al(e, OFS_R(x));
+      return false;
+    }
+
+    case CHIP8_OP_LSHIFT: {
+      byte src = (e->core->quirks & CHIP8_QUIRK_SHIFT_VY) ? y : x;
+      emit_load_al(e, OFS_R(src));
+      emit(e, 0xC0); emit(e, 0xE8); emit(e, 7);   // shr al, 7
+      emit_store_al(e, OFS_R(0xF));
+      emit_load_al(e, OFS_R(src));
+      emit(e, 0xD0); emit(e, 0xE0);               // shl al, 1
+      emit_store_al(e, OFS_R(x));
+      return false;
+    }
+
+    case CHIP8_OP_SET_I: {
+      emit_mov_m16_imm(e, OFS_I, in->nnn);
+      return false;
+    }
+
+    case CHIP8_OP_ADD_I: {
+      emit_movzx_eax(e, OFS_R(x));
+      emit(e, 0x66); emit(e, 0x01); emit_mem(e, 0, OFS_I); // add [I], ax
+      return false;
+    }
+
+    case CHIP8_OP_SETSPRITE: {
+      emit_movzx_eax(e, OFS_R(x));
+      emit(e, 0x83); emit(e, 0xE0); emit(e, 0x0F); // and eax, 15
+      emit(e, 0x6B); emit(e, 0xC0); emit(e, 5);   // imul eax, eax, 5
+      emit(e, 0x66); emit(e, 0x89); emit_mem(e, 0, OFS_I); // mov [I], ax
+      return false;
+    }
+
+    case CHIP8_OP_GET_TIMER: {
+      emit_load_al(e, OFS_TIMER);
+      emit_store_al(e, OFS_R(x));
+      return false;
+    }
+
+    case CHIP8_OP_SET_TIMER: {
+      emit_load_al(e, OFS_R(x));
+      emit_store_al(e, OFS_TIMER);
+      return false;
+    }
+
+    case CHIP8_OP_SET_SOUND: {
+      emit_load_al(e, OFS_R(x));
+      emit_store_al(e, OFS_SOUND);
+      return false;
+    }
+
+    case CHIP8_OP_RANDOM: {
+      // this doesn't care about PC, and whatever it does to it is
+      // overwritten when the block exits
+      emit_call_handler(e, in);
+      return false;
+    }
+
+    case CHIP8_OP_JUMP: {
+      emit_mov_m16_imm(e, OFS_PC, in->nnn);
+      return true;
+    }
+
+    case CHIP8_OP_IFNEQ:
+    case CHIP8_OP_IFEQ: {
+      emit_mov_m16_imm(e, OFS_PC, addr+2);
+      emit(e, 0x80); emit_mem(e, 7, OFS_R(x)); emit(e, in->nn); // cmp byte [Rx], nn
+      emit_skip(e, in->op == CHIP8_OP_IFNEQ ? 0x75 : 0x74, addr); // jne / je
+      return true;
+    }
+
+    case CHIP8_OP_IFNEQ_R:
+    case CHIP8_OP_IFEQ_R: {
+      emit_mov_m16_imm(e, OFS_PC, addr+2);
+      emit_load_al(e, OFS_R(x));
+      emit(e, 0x3A); emit_mem(e, 0, OFS_R(y));    // cmp al, [Ry]
+      emit_skip(e, in->op == CHIP8_OP_IFNEQ_R ? 0x75 : 0x74, addr);
+      return true;
+    }
+
+    case CHIP8_OP_IFNKEY:
+    case CHIP8_OP_IFKEY: {
+      emit_mov_m16_imm(e, OFS_PC, addr+2);
+      emit_movzx_eax(e, OFS_R(x));
+      emit(e, 0x83); emit(e, 0xE0); emit(e, 0x0F); // and eax, 15
+      emit(e, 0x80); emit(e, 0xBC); emit(e, 0x03); // cmp byte [rbx+rax+keys], 0
+      emit32(e, (uint32_t)OFS_KEYS); emit(e, 0);
+      emit_skip(e, in->op == CHIP8_OP_IFNKEY ? 0x74 : 0x75, addr);
+      return true;
+    }
+
+    default: {
+      // Everything else either moves PC itself, can stop the machine
+      // (or chip8_run, like drawing does), or can write to memory
+      // (and so maybe to this very block).
+      // The handler does the work and the block ends right after it.
+      emit_mov_m16_imm(e, OFS_PC, addr);
+      emit_call_handler(e, in);
+      return true;
+    }
+  }
+}
+
+static void chip8_jit_flush(struct chip8_jit *jit) {
+  memset(jit->blocks, 0, sizeof(jit->blocks));
+  memset(jit->covered, 0, sizeof(jit->covered));
+  jit->used = 0;
+}
+
+static chip8_block *chip8_jit_compile(struct chip8_jit *jit, chip8 *ch8, word start) {
+  if (jit->used + JIT_MAX_BLOCK_BYTES > JIT_CODE_SIZE) {
+    chip8_jit_flush(jit);
+  }
+
+  emitter e;
+  e.p = jit->code + jit->used;
+  e.core = ch8->core;
+  byte *entry = e.p;
+
+  emit_prologue(&e);
+
+  word addr = start;
+  word len = 0;
+  bool ended = false;
+  while (!ended && len < JIT_MAX_BLOCK && addr < CHIP8_MEM_SIZE-1) {
+    const chip8_instr *in = &chip8_decode_table[(ch8->mem[addr] << 8) | ch8->mem[addr+1]];
+    ended = emit_instr(&e, in, addr);
+    addr += 2;
+    len++;
+  }
+
+  if (!ended) {
+    // ran out of room, carry on from the next instruction
+    emit_mov_m16_imm(&e, OFS_PC, addr);
+  }
+
+  emit_epilogue(&e);
+
+  jit->used += e.p - entry;
+
+  for (word i=start; i<addr && i<CHIP8_MEM_SIZE; i++) {
+    jit->covered[i] = true;
+  }
+
+  chip8_block *b = &jit->blocks[start];
+  b->fn = (chip8_block_fn)(void*)entry;
+  b->len = len;
+  return b;
+}
+
+bool chip8_jit_enable(chip8 *ch8) {
+  if (ch8->jit != NULL) {
+    chip8_jit_reset(ch8);
+    return true;
+  }
+
+  struct chip8_jit *jit = malloc(sizeof(struct chip8_jit));
+  if (jit == NULL) return false;
+
+#if defined(_WIN32)
+  jit->code = VirtualAlloc(NULL, JIT_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+  if (jit->code == NULL) {
+    free(jit);
+    return false;
+  }
+#else
+  jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (jit->code == MAP_FAILED) {
+    free(jit);
+    return false;
+  }
+#endif
+
+  chip8_jit_flush(jit);
+  ch8->jit = jit;
+  return true;
+}
+
+void chip8_jit_disable(chip8 *ch8) {
+  struct chip8_jit *jit = ch8->jit;
+  if (jit == NULL) return;
+
+#if defined(_WIN32)
+  VirtualFree(jit->code, 0, MEM_RELEASE);
+#else
+  munmap(jit->code, JIT_CODE_SIZE);
+#endif
+
+  free(jit);
+  ch8->jit = NULL;
+}
+
+void chip8_jit_reset(chip8 *ch8) {
+  if (ch8->jit != NULL) chip8_jit_flush(ch8->jit);
+}
+
+void chip8_jit_invalidate(struct chip8_jit *jit, word addr) {
+  // Self-modifying code is rare enough that starting over is fine.
+  // If the write came from inside a block, that block ends right after
+  // the handler returns, and the flushed code stays in the buffer
+  // untouched until the next translation, so returning into it is safe.
+  if (jit->covered[addr]) chip8_jit_flush(jit);
+}
+
+uint32_t chip8_jit_run(chip8 *ch8, uint32_t cycles) {
+  struct chip8_jit *jit = ch8->jit;
+  if (jit == NULL) return 0;
+
+  uint32_t left = cycles;
+  while (left > 0 && !ch8->quit && ch8->stop == CHIP8_STOP_NONE) {
+    word pc = ch8->PC;
+
+    chip8_block *b = NULL;
+    if (pc < CHIP8_MEM_SIZE-1) {
+      b = &jit->blocks[pc];
+      if (b->fn == NULL) b = chip8_jit_compile(jit, ch8, pc);
+    }
+
+    if (b == NULL || b->len > left) {
+      // out of bounds, or not enough budget left for the whole block
+      chip8_step(ch8);
+      left--;
+      continue;
+    }
+
+    // the block may flush the cache (and so *b) on its way out
+    word len = b->len;
+    b->fn(ch8);
+    left -= len;
+    // did the block just go round an idle loop?
+    if (!ch8->quit && ch8->stop == CHIP8_STOP_NONE) {
+      left -= chip8_idle_after_jump(ch8, pc + 2*(len-1), left);
+    }
+  }
+
+  return cycles - left;
+}
+
+#else
+
+// no recompiler for this host
+
+bool chip8_jit_enable(chip8 *ch8) {
+  return false;
+}
+
+void chip8_jit_disable(chip8 *ch8) {
+}
+
+void chip8_jit_reset(chip8 *ch8) {
+}
+
+void chip8_jit_invalidate(struct chip8_jit *jit, word addr) {
+}
+
+uint32_t chip8_jit_run(chip8 *ch8, uint32_t cycles) {
+  return 0;
+}
+
+#endif
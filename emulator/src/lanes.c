@@ -0,0 +1,447 @@
+#include "lanes.h"
+#include "idle.h"
+#include "decode.h"
+#include "ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Plain loops over every lane, written so the compiler can turn each one
+// into a few vector instructions: masks are all-ones or zero per lane,
+// and masked-out lanes keep their old value through a blend, not a branch.
+#define LANE_LOOP(l) for (int l=0; l<CHIP8_LANES; l++)
+#define BLEND(mask, new, old) (((new) & (mask)) | ((old) & ~(mask)))
+
+chip8_lanes *chip8_lanes_create(int count) {
+  if (count < 1 || count > CHIP8_LANES) return NULL;
+
+  chip8_lanes *lanes = chip8_aligned_alloc(sizeof(chip8_lanes));
+  if (lanes == NULL) return NULL;
+
+  memset(lanes, 0, sizeof(chip8_lanes));
+  lanes->count = count;
+  for (int l=0; l<CHIP8_LANES; l++) {
+    chip8_init(&lanes->lane[l]);
+    // the spare lanes never run
+    if (l >= count) lanes->lane[l].quit = true;
+  }
+
+  return lanes;
+}
+
+void chip8_lanes_destroy(chip8_lanes *lanes) {
+  chip8_aligned_free(lanes);
+}
+
+bool chip8_lanes_loadrom(chip8_lanes *lanes, const byte *rom, long length) {
+  for (int l=0; l<lanes->count; l++) {
+    if (!chip8_loadrom(&lanes->lane[l], rom, length)) return false;
+  }
+  return true;
+}
+
+void chip8_lanes_set_profile(chip8_lanes *lanes, chip8_profile profile) {
+  for (int l=0; l<CHIP8_LANES; l++) {
+    chip8_set_profile(&lanes->lane[l], profile);
+  }
+}
+
+// lane l's registers to and from its chip8
+static void lanes_store(chip8_lanes *lanes, int l) {
+  chip8 *ch8 = &lanes->lane[l];
+  for (int r=0; r<16; r++) ch8->R[r] = lanes->R[r][l];
+  ch8->I = lanes->I[l];
+  ch8->PC = lanes->PC[l];
+  ch8->timer = lanes->timer[l];
+  ch8->sound = lanes->sound[l];
+}
+
+static void lanes_load(chip8_lanes *lanes, int l) {
+  chip8 *ch8 = &lanes->lane[l];
+  for (int r=0; r<16; r++) lanes->R[r][l] = ch8->R[r];
+  lanes->I[l] = ch8->I;
+  lanes->PC[l] = ch8->PC;
+  lanes->timer[l] = ch8->timer;
+  lanes->sound[l] = ch8->sound;
+}
+
+// Moves lane l's clock on by n cycles, like chip8_clock_advance
+static void lanes_clock_advance(chip8_lanes *lanes, int l, uint32_t n) {
+  uint32_t cycles_per_tick = lanes->lane[l].cycles_per_tick;
+  while (n >= lanes->tick_left[l]) {
+    n -= lanes->tick_left[l];
+    if (lanes->timer[l] > 0) lanes->timer[l]--;
+    if (lanes->sound[l] > 0) lanes->sound[l]--;
+    lanes->ticked[l]++;
+    lanes->tick_left[l] = cycles_per_tick;
+  }
+  lanes->tick_left[l] -= n;
+}
+
+// Runs the instruction at PC for lane l alone, through its own handlers.
+// Returns false if the lane can't go on this time (quit, or waiting for a key).
+static bool lanes_step_one(chip8_lanes *lanes, int l) {
+  chip8 *ch8 = &lanes->lane[l];
+
+  lanes_store(lanes, l);
+  ch8->stop = CHIP8_STOP_NONE;
+  chip8_step(ch8);
+  lanes_load(lanes, l);
+
+  if (ch8->stop == CHIP8_STOP_KEYWAIT) {
+    // spins on FX0A for the rest of its cycles, as in chip8_run
+    lanes_clock_advance(lanes, l, lanes->left[l]);
+    lanes->left[l] = 0;
+    return false;
+  }
+  return !ch8->quit;
+}
+
+// True if any lane could have different code at addr than the others
+static bool lanes_code_written(const uint64_t *written, word addr) {
+  addr &= CHIP8_ADDR_MASK;
+  word next = (addr+1) & CHIP8_ADDR_MASK;
+  return ((written[addr / 64] >> (addr % 64)) & 1) || ((written[next / 64] >> (next % 64)) & 1);
+}
+
+// The instructions lanes_exec runs for all lanes at once
+// that just move on to the next instruction
+static const bool lanes_straight[CHIP8_OP_COUNT] = {
+  [CHIP8_OP_SET] = true,
+  [CHIP8_OP_ADD] = true,
+  [CHIP8_OP_SET_R] = true,
+  [CHIP8_OP_OR] = true,
+  [CHIP8_OP_AND] = true,
+  [CHIP8_OP_XOR] = true,
+  [CHIP8_OP_ADD_R] = true,
+  [CHIP8_OP_SUB] = true,
+  [CHIP8_OP_RSHIFT] = true,
+  [CHIP8_OP_REVSUB] = true,
+  [CHIP8_OP_LSHIFT] = true,
+  [CHIP8_OP_SET_I] = true,
+  [CHIP8_OP_ADD_I] = true,
+  [CHIP8_OP_SETSPRITE] = true,
+  [CHIP8_OP_GET_TIMER] = true,
+  [CHIP8_OP_SET_TIMER] = true,
+  [CHIP8_OP_SET_SOUND] = true,
+  [CHIP8_OP_BCD] = true,
+};
+
+// Runs `in` on every lane in `on`, all at once where the instruction
+// allows it. Returns false if it had to go one lane at a time instead;
+// the lanes that stopped then have their `on` cleared.
+static bool lanes_exec(chip8_lanes *lanes, const chip8_instr *in, int quirks,
+                       byte on[restrict CHIP8_LANES], const word on16[restrict CHIP8_LANES]) {
+  const byte x = in->x, y = in->y, nn = in->nn;
+  const word nnn = in->nnn;
+  word *restrict PC = lanes->PC;
+  word *restrict I = lanes->I;
+
+  // VX and VY are read from copies, so the compiler can see that writing
+  // a register row never changes what the loop is reading
+  byte vx[CHIP8_LANES], vy[CHIP8_LANES];
+  #define LOAD_XY() \
+    memcpy(vx, lanes->R[x], CHIP8_LANES); \
+    memcpy(vy, lanes->R[y], CHIP8_LANES);
+  #define SET_VX(value) \
+    LANE_LOOP(l) lanes->R[x][l] = BLEND(on[l], (byte)(value), vx[l]);
+  #define SET_VF(value) \
+    LANE_LOOP(l) lanes->R[0xF][l] = BLEND(on[l], (byte)(value), lanes->R[0xF][l]);
+
+  LOAD_XY();
+
+  switch (in->op) {
+    case CHIP8_OP_JUMP: {
+      LANE_LOOP(l) PC[l] = BLEND(on16[l], nnn, PC[l]);
+      return true;
+    }
+
+    case CHIP8_OP_JUMP_R0: {
+      // BXNN reads VX, which is already in vx
+      if (!(quirks & CHIP8_QUIRK_JUMP_VX)) memcpy(vx, lanes->R[0], CHIP8_LANES);
+      LANE_LOOP(l) PC[l] = BLEND(on16[l], (word)(nnn + vx[l]), PC[l]);
+      return true;
+    }
+
+    // skips: PC moves on by 2, or by 4 where the condition holds
+    #define SKIP(cond) \
+      LANE_LOOP(l) PC[l] += on16[l] & (2 + ((cond) ? 2 : 0)); \
+      return true;
+
+    case CHIP8_OP_IFNEQ: SKIP(vx[l] == nn)
+    case CHIP8_OP_IFEQ: SKIP(vx[l] != nn)
+    case CHIP8_OP_IFNEQ_R: SKIP(vx[l] == vy[l])
+    case CHIP8_OP_IFEQ_R: SKIP(vx[l] != vy[l])
+    case CHIP8_OP_IFNKEY: SKIP(lanes->lane[l].keys[vx[l] & 0x0F])
+    case CHIP8_OP_IFKEY: SKIP(!lanes->lane[l].keys[vx[l] & 0x0F])
+
+    #undef SKIP
+
+    default:
+      break;
+  }
+
+  // the rest move on to the next instruction, if they run here at all
+  switch (in->op) {
+    case CHIP8_OP_SET: SET_VX(nn) break;
+    case CHIP8_OP_ADD: SET_VX(vx[l] + nn) break;
+    case CHIP8_OP_SET_R: SET_VX(vy[l]) break;
+    case CHIP8_OP_OR: SET_VX(vx[l] | vy[l]) break;
+    case CHIP8_OP_AND: SET_VX(vx[l] & vy[l]) break;
+    case CHIP8_OP_XOR: SET_VX(vx[l] ^ vy[l]) break;
+
+    // The flag is worked out and written first, then the result from
+    // the registers as they are after that, exactly like the handlers
+    // in ops.h, so X or Y being F comes out the same.
+
+    case CHIP8_OP_ADD_R: {
+      SET_VF(vx[l] + vy[l] > 255)
+      LOAD_XY();
+      SET_VX(vx[l] + vy[l])
+      break;
+    }
+
+    case CHIP8_OP_SUB: {
+      SET_VF(vx[l] >= vy[l])
+      LOAD_XY();
+      SET_VX(vx[l] - vy[l])
+      break;
+    }
+
+    case CHIP8_OP_REVSUB: {
+      SET_VF(vx[l] > vy[l])
+      LOAD_XY();
+      SET_VX(vy[l] - vx[l])
+      break;
+    }
+
+    // vy is reloaded as whichever register gets shifted
+    #define LOAD_SHIFTED() \
+      LOAD_XY(); \
+      if (!(quirks & CHIP8_QUIRK_SHIFT_VY)) memcpy(vy, vx, CHIP8_LANES);
+
+    case CHIP8_OP_RSHIFT: {
+      LOAD_SHIFTED();
+      SET_VF(vy[l] & 0x01)
+      LOAD_SHIFTED();
+      SET_VX(vy[l] >> 1)
+      break;
+    }
+
+    case CHIP8_OP_LSHIFT: {
+      LOAD_SHIFTED();
+      SET_VF(vy[l] >> 7)
+      LOAD_SHIFTED();
+      SET_VX(vy[l] << 1)
+      break;
+    }
+
+    #undef LOAD_SHIFTED
+
+    case CHIP8_OP_SET_I: {
+      LANE_LOOP(l) I[l] = BLEND(on16[l], nnn, I[l]);
+      break;
+    }
+
+    case CHIP8_OP_ADD_I: {
+      LANE_LOOP(l) I[l] = BLEND(on16[l], (word)(I[l] + vx[l]), I[l]);
+      break;
+    }
+
+    case CHIP8_OP_SETSPRITE: {
+      LANE_LOOP(l) I[l] = BLEND(on16[l], (word)((vx[l] & 0x0F) * 5), I[l]);
+      break;
+    }
+
+    case CHIP8_OP_GET_TIMER: SET_VX(lanes->timer[l]) break;
+
+    case CHIP8_OP_SET_TIMER: {
+      LANE_LOOP(l) lanes->timer[l] = BLEND(on[l], vx[l], lanes->timer[l]);
+      break;
+    }
+
+    case CHIP8_OP_SET_SOUND: {
+      LANE_LOOP(l) lanes->sound[l] = BLEND(on[l], vx[l], lanes->sound[l]);
+      break;
+    }
+
+    case CHIP8_OP_BCD: {
+      // does nothing yet, see ops.h
+      break;
+    }
+
+    default: {
+      // one lane at a time
+      LANE_LOOP(l) {
+        if (on[l] && !lanes_step_one(lanes, l)) on[l] = 0;
+      }
+      return false;
+    }
+  }
+
+  #undef LOAD_XY
+  #undef SET_VX
+  #undef SET_VF
+
+  LANE_LOOP(l) PC[l] += on16[l] & 2;
+  return true;
+}
+
+void chip8_lanes_run(chip8_lanes *lanes, uint32_t cycles) {
+  if (cycles == 0) return;
+
+  // copy the registers in, and see which lanes are still going
+  byte live[CHIP8_LANES];
+  uint64_t written[CHIP8_MEM_SIZE / 64] = {0};
+  for (int l=0; l<CHIP8_LANES; l++) {
+    chip8 *ch8 = &lanes->lane[l];
+    lanes_load(lanes, l);
+    lanes->tick_left[l] = ch8->tick_cycles_left;
+    lanes->ticked[l] = 0;
+    lanes->left[l] = cycles;
+    live[l] = (l < lanes->count && !ch8->quit) ? 0xFF : 0;
+    for (int i=0; i<CHIP8_MEM_SIZE / 64; i++) written[i] |= ch8->written[i];
+  }
+
+  const int quirks = lanes->lane[0].core->quirks;
+
+  // Code nobody has written is the same in every lane, so lane 0's will do
+  const byte *mem = lanes->lane[0].mem;
+  #define SHARED_CODE(pc) ((pc) < CHIP8_MEM_SIZE-1 && !lanes_code_written(written, (pc)))
+  #define DECODE(pc) (&chip8_decode_table[(mem[(pc)] << 8) | mem[(pc)+1]])
+
+  while (true) {
+    // The lane furthest behind leads (the lowest PC if several are),
+    // so lanes that are in the same loop run it in step.
+    uint32_t most = 0;
+    LANE_LOOP(l) {
+      uint32_t left = lanes->left[l] & -(uint32_t)(live[l] & 1);
+      most = left > most ? left : most;
+    }
+    if (most == 0) break;
+
+    word pc = 0xFFFF;
+    LANE_LOOP(l) {
+      word lead = -(word)((lanes->left[l] == most) & live[l] & 1);
+      word p = lanes->PC[l] | ~lead;
+      pc = p < pc ? p : pc;
+    }
+
+    // and every lane that's there comes along
+    byte on[CHIP8_LANES], ran[CHIP8_LANES];
+    word on16[CHIP8_LANES];
+    LANE_LOOP(l) on16[l] = -(word)(lanes->PC[l] == pc) & (word)(int8_t)live[l];
+    LANE_LOOP(l) on[l] = ran[l] = (byte)on16[l];
+
+    // Straight-line code runs with no bookkeeping between instructions,
+    // as long as none of these lanes can tick or run out on the way.
+    if (SHARED_CODE(pc) && lanes_straight[DECODE(pc)->op]) {
+      uint32_t room = UINT32_MAX;
+      LANE_LOOP(l) {
+        uint32_t r = lanes->left[l] < lanes->tick_left[l] ? lanes->left[l] : lanes->tick_left[l];
+        r |= ~(uint32_t)(int8_t)ran[l];
+        room = r < room ? r : room;
+      }
+
+      uint32_t n = 0;
+      while (n+1 < room && SHARED_CODE(pc) && lanes_straight[DECODE(pc)->op]) {
+        lanes_exec(lanes, DECODE(pc), quirks, on, on16);
+        pc += 2;
+        n++;
+      }
+
+      LANE_LOOP(l) {
+        uint32_t ran32 = (uint32_t)(int8_t)ran[l];
+        lanes->left[l] -= n & ran32;
+        lanes->tick_left[l] -= n & ran32;
+      }
+      lanes->steps += n;
+    }
+
+    lanes->steps++;
+
+    // Then one instruction for all of them, unless a lane might have written
+    // different code there or it's off the end of memory, then one each.
+    bool loopBack = false;
+    if (SHARED_CODE(pc)) {
+      const chip8_instr *in = DECODE(pc);
+      // only a jump a little way back can close an idle loop
+      loopBack = in->op == CHIP8_OP_JUMP && in->nnn <= pc && pc - in->nnn < 2*CHIP8_IDLE_MAX_LOOP;
+
+      if (!lanes_exec(lanes, in, quirks, on, on16)) {
+        // lanes that stopped are out of `on` now, but the instruction
+        // still counts for those that quit
+        LANE_LOOP(l) {
+          if (ran[l] && !on[l] && lanes->lane[l].quit) {
+            lanes_clock_advance(lanes, l, 1);
+            lanes->left[l]--;
+          }
+        }
+        if (in->op == CHIP8_OP_DUMP) {
+          LANE_LOOP(l) {
+            if (ran[l]) {
+              for (int i=0; i<CHIP8_MEM_SIZE / 64; i++) written[i] |= lanes->lane[l].written[i];
+            }
+          }
+        }
+      }
+    } else {
+      LANE_LOOP(l) {
+        if (on[l] && !lanes_step_one(lanes, l)) {
+          if (lanes->lane[l].quit) {
+            lanes_clock_advance(lanes, l, 1);
+            lanes->left[l]--;
+          }
+          on[l] = 0;
+        }
+        if (ran[l]) {
+          for (int i=0; i<CHIP8_MEM_SIZE / 64; i++) written[i] |= lanes->lane[l].written[i];
+        }
+      }
+    }
+
+    // one cycle less for everyone that ran, and tick their clocks
+    uint32_t tick = 0;
+    LANE_LOOP(l) {
+      uint32_t one = on[l] & 1;
+      lanes->left[l] -= one;
+      lanes->tick_left[l] -= one;
+      tick |= one & (lanes->tick_left[l] == 0);
+    }
+
+    if (tick) {
+      LANE_LOOP(l) {
+        if (on[l] && lanes->tick_left[l] == 0) lanes_clock_advance(lanes, l, 0);
+      }
+    }
+
+    // lanes that just went round an idle loop skip to the next tick,
+    // each on its own, since their timers and keys can differ
+    if (loopBack) {
+      LANE_LOOP(l) {
+        if (!on[l]) continue;
+        uint32_t budget = lanes->left[l] < lanes->tick_left[l] ? lanes->left[l] : lanes->tick_left[l];
+        lanes_store(lanes, l);
+        uint32_t n = chip8_idle_skip(&lanes->lane[l], budget);
+        if (n == 0) continue;
+        lanes_load(lanes, l);
+        lanes->left[l] -= n;
+        lanes->tick_left[l] -= n;
+        if (lanes->tick_left[l] == 0) lanes_clock_advance(lanes, l, 0);
+      }
+    }
+
+    // lanes that stopped or ran out of cycles are done
+    LANE_LOOP(l) live[l] &= ~ran[l] | (on[l] & -(byte)(lanes->left[l] != 0));
+  }
+
+  // and back out
+  for (int l=0; l<lanes->count; l++) {
+    chip8 *ch8 = &lanes->lane[l];
+    lanes_store(lanes, l);
+    ch8->cycles += cycles - lanes->left[l];
+    ch8->ticks += lanes->ticked[l];
+    ch8->tick_cycles_left = lanes->tick_left[l];
+    ch8->stop = CHIP8_STOP_NONE;
+  }
+}
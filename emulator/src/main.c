@@ -2,8 +2,50 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "chip8.h"
+#include "threaded.h"
+#include "jit.h"
+#include "pixels.h"
+#include "quirks.h"
+#include "movie.h"
+#include "rewind.h"
+#include "snapshot.h"
+#include "screenbuf.h"
+
+#include <stdatomic.h>
+
+#ifdef __linux__
+#include <errno.h>
+#define PRECISE_SLEEP
+#else
+// how late SDL_Delay is allowed to wake up, see sleep_until
+#define DELAY_SLACK_NS 250000
+#endif
+
+#ifdef CHIP8_AOT
+#include "aot.h"
+#endif
+
+// holding backspace goes back up to 10 seconds
+#define REWIND_KEY SDLK_BACKSPACE
+#define REWIND_FRAMES (10 * 60)
+#define REWIND_BYTES (2 * 1024 * 1024)
+
+// the timers tick at 60 Hz, one frame each
+#define FRAME_NS (1000000000ull / 60)
+// More frames behind than this and the missed ones are dropped instead
+// of all being run back to back
+#define MAX_CATCH_UP 4
+
+// at most this many frames of run-ahead
+#define MAX_RUN_AHEAD 8
+
+// RGBA8888
+#define COLOR_ON 0xFFFFFFFF
+#define COLOR_OFF 0x000000FF
 
 byte *load_rom_from_file(const char *path, long *len) {
 
@@ -42,24 +84,223 @@ byte *load_rom_from_file(const char *path, long *len) {
   return buffer;
 }
 
+// Copies the changed rows into the streaming texture and shows it
+bool present_screen(SDL_Renderer *renderer, SDL_Texture *texture, const uint64_t *screen, uint32_t dirty) {
+  int first = 0, last = CHIP8_SCREEN_H-1;
+  while (!(dirty & ((uint32_t)1 << first))) first++;
+  while (!(dirty & ((uint32_t)1 << last))) last--;
+
+  SDL_Rect rows = { 0, first, CHIP8_SCREEN_W, last-first+1 };
+  void *pixels;
+  int pitch;
+  if (SDL_LockTexture(texture, &rows, &pixels, &pitch) != 0) {
+    return false;
+  }
+
+  chip8_expand_rows(screen+first, rows.h, pixels, pitch, 1, COLOR_ON, COLOR_OFF);
+  SDL_UnlockTexture(texture);
+
+  SDL_RenderCopy(renderer, texture, NULL, NULL);
+  SDL_RenderPresent(renderer);
+  return true;
+}
+
+// The keypad key for a keyboard key, or -1
+int keypad_key(SDL_Keycode key) {
+  switch (key) {
+    case SDLK_1: return 0x1;
+    case SDLK_2: return 0x2;
+    case SDLK_3: return 0x3;
+    case SDLK_q: return 0x4;
+    case SDLK_w: return 0x5;
+    case SDLK_e: return 0x6;
+    case SDLK_a: return 0x7;
+    case SDLK_s: return 0x8;
+    case SDLK_d: return 0x9;
+
+    case SDLK_UP: return 0x2;
+    case SDLK_DOWN: return 0x8;
+    case SDLK_LEFT: return 0x4;
+    case SDLK_RIGHT: return 0x6;
+
+    default: return -1;
+  }
+}
+
+// The machine runs on its own thread, so waiting for vsync in
+// SDL_RenderPresent doesn't hold it up. While it runs, the main thread
+// only touches the atomics and the reading end of `screens`.
+typedef struct {
+  chip8 *ch8;
+
+  // Keys go to the machine once per frame: from the movie while one is
+  // playing, otherwise whatever is held down, recorded if asked to.
+  chip8_movie *movie;
+  bool playing, recording;
+
+  chip8_rewind *rewinder; // NULL when rewinding is off
+  int runAhead;
+  chip8_savestate real;
+
+  chip8_screenbuf screens;
+
+  atomic_uint held;      // keypad keys held down, bit k for key k
+  atomic_bool rewinding; // the rewind key is down
+  atomic_bool stop;      // the window was closed
+  atomic_bool done;      // the machine stopped, or was told to
+} emulation;
+
+// Runs one frame's worth of the machine, or takes one back
+static void emulate_frame(emulation *emu) {
+  chip8 *ch8 = emu->ch8;
+
+  if (emu->rewinder != NULL && atomic_load(&emu->rewinding)) {
+    // a frame back instead of one forward, until there's none left
+    if (chip8_rewind_pop(emu->rewinder, ch8) && ch8->screen_changed) {
+      chip8_screenbuf_publish(&emu->screens, ch8);
+      chip8_clear_dirty(ch8);
+    }
+    return;
+  }
+
+  if (emu->rewinder != NULL) chip8_rewind_push(emu->rewinder, ch8);
+  uint16_t held = atomic_load(&emu->held);
+  if (emu->recording) chip8_movie_record(emu->movie, ch8, held);
+  else if (!emu->playing) chip8_set_keys(ch8, held);
+
+  if (emu->playing) {
+    // one timer tick's worth of instructions, the core ticks the timers
+    uint64_t tick = ch8->ticks;
+    while (!ch8->quit && ch8->ticks == tick) {
+      // stop where the movie changes keys, so it plays back exactly
+      emu->playing = chip8_movie_play(emu->movie, ch8);
+      uint32_t budget = chip8_movie_cycles_until_event(emu->movie, ch8, chip8_cycles_until_tick(ch8));
+      chip8_run(ch8, budget);
+    }
+  } else {
+    chip8_run_frame(ch8);
+  }
+
+  if (emu->runAhead > 0 && !ch8->quit) {
+    // show the future, then go back to the present
+    chip8_snapshot(ch8, &emu->real);
+    for (int i=0; i<emu->runAhead && !ch8->quit; i++) {
+      chip8_run_frame(ch8);
+    }
+    if (ch8->screen_changed) chip8_screenbuf_publish(&emu->screens, ch8);
+    chip8_clear_dirty(ch8);
+    // marks whatever differs from what was just shown as changed
+    chip8_restore(ch8, &emu->real);
+  } else if (ch8->screen_changed) {
+    chip8_screenbuf_publish(&emu->screens, ch8);
+    chip8_clear_dirty(ch8);
+  }
+}
+
+// Nanoseconds on a clock that only goes forward
+static uint64_t now_ns(void) {
+#ifdef PRECISE_SLEEP
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#else
+  uint64_t t = SDL_GetPerformanceCounter();
+  uint64_t freq = SDL_GetPerformanceFrequency();
+  return t / freq * 1000000000ull + t % freq * 1000000000ull / freq;
+#endif
+}
+
+static void sleep_until(uint64_t deadline) {
+#ifdef PRECISE_SLEEP
+  struct timespec ts = { deadline / 1000000000ull, deadline % 1000000000ull };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+#else
+  // SDL_Delay only does whole milliseconds and tends to wake up a little
+  // late, so it sleeps as many as fit before the last DELAY_SLACK_NS and
+  // only what's left after that is spun away
+  uint64_t now;
+  while ((now = now_ns()) < deadline) {
+    uint64_t left = deadline - now;
+    if (left >= DELAY_SLACK_NS + 1000000) {
+      SDL_Delay((left - DELAY_SLACK_NS) / 1000000);
+    }
+  }
+#endif
+}
+
+static int emulate(void *data) {
+  emulation *emu = data;
+
+  // Frames are due on a fixed cadence from the start, so they don't
+  // drift. Running late, they're run back to back to catch up, early,
+  // the thread sleeps until the next one is due.
+  uint64_t next_frame = now_ns();
+  while (!emu->ch8->quit && !atomic_load(&emu->stop)) {
+    uint64_t now = now_ns();
+    if (now < next_frame) {
+      sleep_until(next_frame);
+      continue;
+    }
+
+    emulate_frame(emu);
+    next_frame += FRAME_NS;
+    if (now > next_frame + MAX_CATCH_UP * FRAME_NS) {
+      // too far behind (a slow machine, or the process was stopped),
+      // carry on from now
+      next_frame = now;
+    }
+  }
+
+  atomic_store(&emu->done, true);
+  return 0;
+}
 
 int main(int argc, char *argv[]) {
 
+  // chip8 [-r <movie to record>] [-m <movie to play>] [-a <frames>]
+  //       [-i <instructions per frame>] [rom]
+  const char *recordPath = NULL;
+  const char *playPath = NULL;
+  int runAhead = 0;
+  uint32_t cyclesPerTick = CHIP8_DEFAULT_CYCLES_PER_TICK;
+#ifndef CHIP8_AOT
+  const char *path = "out.ch8rom";
+#endif
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "-r") == 0 && i+1 < argc) recordPath = argv[++i];
+    else if (strcmp(argv[i], "-m") == 0 && i+1 < argc) playPath = argv[++i];
+    else if (strcmp(argv[i], "-a") == 0 && i+1 < argc) runAhead = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-i") == 0 && i+1 < argc) cyclesPerTick = strtoul(argv[++i], NULL, 10);
+#ifndef CHIP8_AOT
+    else path = argv[i];
+#endif
+  }
+
   chip8 ch8;
   if (!chip8_init(&ch8)) {
     printf("Failed to start Chip-8\n");
     return 1;
   }
+  // a different game every time
+  chip8_seed(&ch8, time(NULL));
 
+#ifdef CHIP8_AOT
+  // the ROM was compiled in by ch8recomp
+  if (!chip8_loadrom(&ch8, chip8_aot_rom, chip8_aot_rom_length)) {
+    printf("%s\n", ch8.errormsg);
+  }
+  chip8_set_profile(&ch8, chip8_aot_profile);
+  chip8_aot_enable(&ch8, chip8_aot_blocks);
+#else
   long length = 44;
-  byte *rom = load_rom_from_file("out.ch8rom", &length);
+  byte *rom = load_rom_from_file(path, &length);
   if (rom == NULL) {
-    printf("Failed to read ROM 'out.ch8rom'\n");
+    printf("Failed to read ROM '%s'\n", path);
     free(rom);
     chip8_quit(&ch8);
     return 1;
   } else if (length > CHIP8_MAX_PROGRAM_SIZE) {
-    printf("ROM too large: 'out.ch8rom'\n");
+    printf("ROM too large: '%s'\n", path);
     free(rom);
     chip8_quit(&ch8);
     return 1;
@@ -70,6 +311,65 @@ int main(int argc, char *argv[]) {
   }
   free(rom);
 
+  // the quirks differ between variants, guess which one from the extension
+  chip8_set_profile(&ch8, chip8_guess_profile(path));
+
+  if (!chip8_jit_enable(&ch8)) {
+    chip8_threaded_enable(&ch8);
+  }
+#endif
+
+  // 60 frames a second, so 60 times this many instructions
+  chip8_set_cycles_per_tick(&ch8, cyclesPerTick);
+
+  chip8_movie movie = {0};
+  bool playing = false, recording = false;
+
+  if (playPath != NULL) {
+    if (!chip8_movie_load(&movie, playPath)) {
+      printf("Failed to read movie '%s'\n", playPath);
+      chip8_quit(&ch8);
+      return 1;
+    }
+    if (!chip8_movie_play_start(&movie, &ch8)) {
+      printf("Movie '%s' was recorded with a different ROM\n", playPath);
+      chip8_movie_free(&movie);
+      chip8_quit(&ch8);
+      return 1;
+    }
+    playing = true;
+  } else if (recordPath != NULL) {
+    recording = chip8_movie_record_start(&movie, &ch8);
+  }
+
+  // Run-ahead: after each frame, run a few more with the same keys, show
+  // the screen from then, and go back. A game that only looks at the keys
+  // every few frames then answers them that much sooner.
+  if (runAhead < 0) runAhead = 0;
+  if (runAhead > MAX_RUN_AHEAD) runAhead = MAX_RUN_AHEAD;
+  // a movie can't be played ahead of itself
+  if (playing) runAhead = 0;
+
+  // not with a movie going, that only goes forward
+  chip8_rewind *rewinder = NULL;
+  if (!playing && !recording) {
+    rewinder = chip8_rewind_create(REWIND_FRAMES, REWIND_BYTES);
+  }
+
+  // big (a save state and three screens), so not on the stack
+  static emulation emu;
+  emu.ch8 = &ch8;
+  emu.movie = &movie;
+  emu.playing = playing;
+  emu.recording = recording;
+  emu.rewinder = rewinder;
+  emu.runAhead = runAhead;
+  chip8_screenbuf_init(&emu.screens);
+  atomic_init(&emu.held, 0);
+  atomic_init(&emu.rewinding, false);
+  atomic_init(&emu.stop, false);
+  atomic_init(&emu.done, false);
+
   SDL_Init(SDL_INIT_VIDEO);
 
   SDL_Window *window = SDL_CreateWindow(
@@ -90,113 +390,100 @@ int main(int argc, char *argv[]) {
   SDL_Texture *screen = SDL_CreateTexture(
     renderer,
     SDL_PIXELFORMAT_RGBA8888,
-    SDL_TEXTUREACCESS_TARGET,
+    SDL_TEXTUREACCESS_STREAMING,
     CHIP8_SCREEN_W, CHIP8_SCREEN_H
   );
 
+  int status = 0;
+
   if (screen == NULL) {
     printf("Failed to create screen texture\n");
-    chip8_quit(&ch8);
-    return 1;
+    status = 1;
+    goto teardown;
+  }
+
+  SDL_Thread *thread = SDL_CreateThread(emulate, "chip8", &emu);
+  if (thread == NULL) {
+    printf("Failed to start the emulation thread\n");
+    status = 1;
+    goto teardown;
   }
 
-  uint32_t next_timer_update = 0;
-  uint32_t next_screen_update = 0;
-  uint32_t next_chip8_step = 0;
+  // what's on screen now
+  uint64_t shown[CHIP8_SCREEN_H] = {0};
+  bool redraw = true;
+  uint16_t held = 0;
 
-  while (!ch8.quit) {
+  while (!atomic_load(&emu.done)) {
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
       switch (event.type) {
         case SDL_QUIT: {
-          ch8.quit = true;
+          atomic_store(&emu.stop, true);
           break;
         }
 
-        case SDL_KEYDOWN: {
-          switch (event.key.keysym.sym) {
-            case SDLK_1: ch8.keys[0x1] = true; break;
-            case SDLK_2: ch8.keys[0x2] = true; break;
-            case SDLK_3: ch8.keys[0x3] = true; break;
-            case SDLK_q: ch8.keys[0x4] = true; break;
-            case SDLK_w: ch8.keys[0x5] = true; break;
-            case SDLK_e: ch8.keys[0x6] = true; break;
-            case SDLK_a: ch8.keys[0x7] = true; break;
-            case SDLK_s: ch8.keys[0x8] = true; break;
-            case SDLK_d: ch8.keys[0x9] = true; break;
-
-            case SDLK_UP: ch8.keys[0x2] = true; break;
-            case SDLK_DOWN: ch8.keys[0x8] = true; break;
-            case SDLK_LEFT: ch8.keys[0x4] = true; break;
-            case SDLK_RIGHT: ch8.keys[0x6] = true; break;
-          }
+        case SDL_WINDOWEVENT: {
+          // resized, uncovered, etc.
+          redraw = true;
           break;
         }
 
+        case SDL_KEYDOWN:
         case SDL_KEYUP: {
-          switch (event.key.keysym.sym) {
-            case SDLK_1: ch8.keys[0x1] = false; break;
-            case SDLK_2: ch8.keys[0x2] = false; break;
-            case SDLK_3: ch8.keys[0x3] = false; break;
-            case SDLK_q: ch8.keys[0x4] = false; break;
-            case SDLK_w: ch8.keys[0x5] = false; break;
-            case SDLK_e: ch8.keys[0x6] = false; break;
-            case SDLK_a: ch8.keys[0x7] = false; break;
-            case SDLK_s: ch8.keys[0x8] = false; break;
-            case SDLK_d: ch8.keys[0x9] = false; break;
-
-            case SDLK_UP: ch8.keys[0x2] = false; break;
-            case SDLK_DOWN: ch8.keys[0x8] = false; break;
-            case SDLK_LEFT: ch8.keys[0x4] = false; break;
-            case SDLK_RIGHT: ch8.keys[0x6] = false; break;
+          if (event.key.keysym.sym == REWIND_KEY) {
+            atomic_store(&emu.rewinding, event.type == SDL_KEYDOWN);
+          }
+          int key = keypad_key(event.key.keysym.sym);
+          if (key >= 0) {
+            if (event.type == SDL_KEYDOWN) held |= 1 << key;
+            else held &= ~(1 << key);
+            atomic_store(&emu.held, held);
           }
           break;
         }
       }
     }
 
-    if (SDL_GetTicks() >= next_timer_update) {
-      chip8_timer_tick(&ch8);
-      next_timer_update = SDL_GetTicks() + 16;
+    uint32_t dirty = redraw ? ~(uint32_t)0 : 0;
+    const uint64_t *latest = chip8_screenbuf_acquire(&emu.screens);
+    if (latest != NULL) {
+      for (int y=0; y<CHIP8_SCREEN_H; y++) {
+        if (latest[y] != shown[y]) dirty |= (uint32_t)1 << y;
+      }
+      memcpy(shown, latest, sizeof(shown));
     }
 
-    if (SDL_GetTicks() >= next_chip8_step) {
-      //printf("[%04X] %02X%02X\n", ch8.PC, ch8.mem[ch8.PC], ch8.mem[ch8.PC+1]);
-      chip8_step(&ch8);
-      next_chip8_step = SDL_GetTicks() + 0;
+    if (dirty != 0) {
+      // waits for vsync, but only this thread
+      redraw = !present_screen(renderer, screen, shown, dirty);
+    } else {
+      SDL_Delay(1);
     }
+  }
 
+  SDL_WaitThread(thread, NULL);
 
-    if (SDL_GetTicks() >= next_screen_update) {
-
-      SDL_SetRenderTarget(renderer, screen);
-      SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-      SDL_RenderClear(renderer);
-      SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-      for (int i=0; i<CHIP8_SCREEN_W; i++) {
-        for (int j=0; j<CHIP8_SCREEN_H; j++) {
-          if (ch8.screen[i][j]) {
-            SDL_RenderDrawPoint(renderer, i, j);
-          }
-        }
-      }
-
-      SDL_SetRenderTarget(renderer, NULL);
-      SDL_RenderCopy(renderer, screen, NULL, NULL);
-      SDL_RenderPresent(renderer);
+  if (ch8.waserror) {
+    printf("CHIP-8 ERROR: %s\n", ch8.errormsg);
+  }
 
-      next_screen_update = SDL_GetTicks() + 32;
+  if (recording) {
+    chip8_movie_record_stop(&movie, &ch8);
+    if (!chip8_movie_save(&movie, recordPath)) {
+      printf("Failed to write movie '%s'\n", recordPath);
     }
-
-    //SDL_Delay(1);
   }
+teardown:
+  chip8_movie_free(&movie);
+  chip8_rewind_destroy(rewinder);
 
-  if (ch8.waserror) {
-    printf("CHIP-8 ERROR: %s\n", ch8.errormsg);
-  }
+  if (screen != NULL) SDL_DestroyTexture(screen);
+  if (renderer != NULL) SDL_DestroyRenderer(renderer);
+  if (window != NULL) SDL_DestroyWindow(window);
 
   chip8_quit(&ch8);
   SDL_Quit();
 
-  return 0;
+  return status;
 }
@@ -0,0 +1,147 @@
+#include "movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// FNV-1a over the program area, to tell ROMs apart
+static uint64_t program_hash(const chip8 *ch8) {
+  uint64_t h = 0xCBF29CE484222325;
+  for (int i=CHIP8_PROGRAM_START_ADDRESS; i<CHIP8_MEM_SIZE; i++) {
+    h = (h ^ ch8->mem[i]) * 0x100000001B3;
+  }
+  return h;
+}
+
+static bool add_event(chip8_movie *movie, uint64_t cycle, uint16_t keys) {
+  if (movie->count == movie->capacity) {
+    int capacity = movie->capacity ? movie->capacity*2 : 256;
+    chip8_movie_event *events = realloc(movie->events, capacity * sizeof(chip8_movie_event));
+    if (events == NULL) return false;
+    movie->events = events;
+    movie->capacity = capacity;
+  }
+  movie->events[movie->count++] = (chip8_movie_event){ cycle, keys };
+  return true;
+}
+
+bool chip8_movie_record_start(chip8_movie *movie, const chip8 *ch8) {
+  memset(movie, 0, sizeof(chip8_movie));
+  movie->profile = ch8->core - chip8_cores;
+  movie->cycles_per_tick = ch8->cycles_per_tick;
+  movie->rng = ch8->rng;
+  movie->rom_hash = program_hash(ch8);
+  movie->end_cycles = ch8->cycles;
+
+  // whatever is held to begin with
+  return add_event(movie, ch8->cycles, chip8_get_keys(ch8));
+}
+
+void chip8_movie_record(chip8_movie *movie, chip8 *ch8, uint16_t keys) {
+  if (keys != movie->events[movie->count-1].keys) {
+    // nothing useful to do if this fails, the keys still work
+    add_event(movie, ch8->cycles, keys);
+  }
+  chip8_set_keys(ch8, keys);
+}
+
+void chip8_movie_record_stop(chip8_movie *movie, const chip8 *ch8) {
+  movie->end_cycles = ch8->cycles;
+}
+
+bool chip8_movie_play_start(chip8_movie *movie, chip8 *ch8) {
+  if (program_hash(ch8) != movie->rom_hash) return false;
+
+  chip8_set_profile(ch8, movie->profile);
+  chip8_set_cycles_per_tick(ch8, movie->cycles_per_tick);
+  // the clock starts on a whole frame, like it did when recording
+  ch8->tick_cycles_left = movie->cycles_per_tick;
+  ch8->rng = movie->rng;
+  movie->next = 0;
+  return true;
+}
+
+bool chip8_movie_play(chip8_movie *movie, chip8 *ch8) {
+  while (movie->next < movie->count && movie->events[movie->next].cycle <= ch8->cycles) {
+    chip8_set_keys(ch8, movie->events[movie->next].keys);
+    movie->next++;
+  }
+  return movie->next < movie->count || ch8->cycles < movie->end_cycles;
+}
+
+uint32_t chip8_movie_cycles_until_event(const chip8_movie *movie, const chip8 *ch8, uint32_t max) {
+  uint64_t until = movie->next < movie->count ? movie->events[movie->next].cycle : movie->end_cycles;
+  if (until <= ch8->cycles) return max;
+  return until - ch8->cycles < max ? until - ch8->cycles : max;
+}
+
+static void put(FILE *fp, uint64_t v, int bytes) {
+  for (int i=0; i<bytes; i++) fputc((v >> (i*8)) & 0xFF, fp);
+}
+
+static bool get(FILE *fp, uint64_t *v, int bytes) {
+  *v = 0;
+  for (int i=0; i<bytes; i++) {
+    int c = fgetc(fp);
+    if (c == EOF) return false;
+    *v |= (uint64_t)c << (i*8);
+  }
+  return true;
+}
+
+bool chip8_movie_save(const chip8_movie *movie, const char *path) {
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL) return false;
+
+  fputs("CH8M", fp);
+  put(fp, CHIP8_MOVIE_VERSION, 4);
+  put(fp, movie->profile, 4);
+  put(fp, movie->cycles_per_tick, 4);
+  put(fp, movie->rng, 8);
+  put(fp, movie->rom_hash, 8);
+  put(fp, movie->end_cycles, 8);
+  put(fp, movie->count, 4);
+
+  for (int i=0; i<movie->count; i++) {
+    put(fp, movie->events[i].cycle, 8);
+    put(fp, movie->events[i].keys, 2);
+  }
+
+  bool ok = !ferror(fp);
+  return fclose(fp) == 0 && ok;
+}
+
+bool chip8_movie_load(chip8_movie *movie, const char *path) {
+  memset(movie, 0, sizeof(chip8_movie));
+
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) return false;
+
+  char magic[4];
+  uint64_t version, profile = 0, cycles_per_tick = 0, count;
+  bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "CH8M", 4) == 0
+    && get(fp, &version, 4) && version == CHIP8_MOVIE_VERSION
+    && get(fp, &profile, 4) && profile < CHIP8_PROFILE_COUNT
+    && get(fp, &cycles_per_tick, 4) && cycles_per_tick > 0
+    && get(fp, &movie->rng, 8) && movie->rng != 0
+    && get(fp, &movie->rom_hash, 8)
+    && get(fp, &movie->end_cycles, 8)
+    && get(fp, &count, 4) && count < INT32_MAX;
+
+  movie->profile = profile;
+  movie->cycles_per_tick = cycles_per_tick;
+
+  for (uint64_t i=0; ok && i<count; i++) {
+    uint64_t cycle, keys;
+    ok = get(fp, &cycle, 8) && get(fp, &keys, 2) && add_event(movie, cycle, keys);
+  }
+
+  fclose(fp);
+  if (!ok) chip8_movie_free(movie);
+  return ok;
+}
+
+void chip8_movie_free(chip8_movie *movie) {
+  free(movie->events);
+  memset(movie, 0, sizeof(chip8_movie));
+}
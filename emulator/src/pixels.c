@@ -0,0 +1,118 @@
+#include "pixels.h"
+
+#include <string.h>
+
+#ifndef CHIP8_PIXELS_SIMD
+#if defined(__AVX2__)
+#define CHIP8_PIXELS_SIMD 2
+#elif defined(__SSE2__) || defined(_M_X64)
+#define CHIP8_PIXELS_SIMD 1
+#else
+#define CHIP8_PIXELS_SIMD 0
+#endif
+#endif
+
+#if CHIP8_PIXELS_SIMD >= 2
+#include <immintrin.h>
+#elif CHIP8_PIXELS_SIMD == 1
+#include <emmintrin.h>
+#endif
+
+// everything chip8_expand_row needs, worked out once per frame
+typedef struct {
+#if CHIP8_PIXELS_SIMD >= 2
+  __m256i bits, off, diff;
+#elif CHIP8_PIXELS_SIMD == 1
+  __m128i patterns[16]; // every 4-pixel combination
+#else
+  uint32_t off, diff;
+#endif
+} chip8_palette;
+
+static void chip8_palette_init(chip8_palette *pal, uint32_t on, uint32_t off) {
+#if CHIP8_PIXELS_SIMD >= 2
+  pal->bits = _mm256_setr_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+  pal->off = _mm256_set1_epi32(off);
+  pal->diff = _mm256_set1_epi32(on ^ off);
+#elif CHIP8_PIXELS_SIMD == 1
+  for (int i=0; i<16; i++) {
+    pal->patterns[i] = _mm_setr_epi32(i & 8 ? on : off, i & 4 ? on : off,
+                                      i & 2 ? on : off, i & 1 ? on : off);
+  }
+#else
+  pal->off = off;
+  pal->diff = on ^ off;
+#endif
+}
+
+// One row at 1x: 64 pixels, leftmost from the top bit
+static inline void chip8_expand_row(const chip8_palette *pal, uint64_t row, uint32_t *out) {
+#if CHIP8_PIXELS_SIMD >= 2
+  // 8 pixels at a time: spread a byte over 8 lanes, one bit per lane,
+  // and turn each lane into all ones or all zeroes
+  for (int x=0; x<CHIP8_SCREEN_W; x+=8) {
+    __m256i b = _mm256_set1_epi32((row >> (CHIP8_SCREEN_W-8 - x)) & 0xFF);
+    __m256i lit = _mm256_cmpeq_epi32(_mm256_and_si256(b, pal->bits), pal->bits);
+    __m256i px = _mm256_xor_si256(pal->off, _mm256_and_si256(lit, pal->diff));
+    _mm256_storeu_si256((__m256i*)(out+x), px);
+  }
+#elif CHIP8_PIXELS_SIMD == 1
+  // 4 pixels at a time, straight from the table
+  for (int x=0; x<CHIP8_SCREEN_W; x+=16) {
+    uint16_t bits = row >> (CHIP8_SCREEN_W-16 - x);
+    _mm_storeu_si128((__m128i*)(out+x), pal->patterns[bits >> 12]);
+    _mm_storeu_si128((__m128i*)(out+x+4), pal->patterns[(bits >> 8) & 0xF]);
+    _mm_storeu_si128((__m128i*)(out+x+8), pal->patterns[(bits >> 4) & 0xF]);
+    _mm_storeu_si128((__m128i*)(out+x+12), pal->patterns[bits & 0xF]);
+  }
+#else
+  for (int x=0; x<CHIP8_SCREEN_W; x++) {
+    uint32_t lit = -(uint32_t)((row >> (CHIP8_SCREEN_W-1 - x)) & 1);
+    out[x] = pal->off ^ (lit & pal->diff);
+  }
+#endif
+}
+
+void chip8_expand_screen(const uint64_t screen[CHIP8_SCREEN_H], uint32_t *out, int pitch,
+                         int scale, uint32_t on, uint32_t off) {
+  chip8_expand_rows(screen, CHIP8_SCREEN_H, out, pitch, scale, on, off);
+}
+
+void chip8_expand_rows(const uint64_t *rows, int count, uint32_t *out, int pitch,
+                       int scale, uint32_t on, uint32_t off) {
+  chip8_palette pal;
+  chip8_palette_init(&pal, on, off);
+
+  byte *line = (byte*)out;
+
+  if (scale <= 1) {
+    for (int y=0; y<count; y++) {
+      chip8_expand_row(&pal, rows[y], (uint32_t*)line);
+      line += pitch;
+    }
+    return;
+  }
+
+  uint32_t small[CHIP8_SCREEN_W];
+  int width = CHIP8_SCREEN_W * scale;
+
+  for (int y=0; y<count; y++) {
+    chip8_expand_row(&pal, rows[y], small);
+
+    // stretch it sideways (the compiler turns this into wide stores)...
+    uint32_t *first = (uint32_t*)line;
+    for (int x=0; x<CHIP8_SCREEN_W; x++) {
+      uint32_t *px = first + x*scale;
+      for (int i=0; i<scale; i++) {
+        px[i] = small[x];
+      }
+    }
+    line += pitch;
+
+    // ...and copy it down
+    for (int i=1; i<scale; i++) {
+      memcpy(line, first, width * sizeof(uint32_t));
+      line += pitch;
+    }
+  }
+}
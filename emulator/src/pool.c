@@ -0,0 +1,141 @@
+#include "pool.h"
+#include "threaded.h"
+#include "jit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FIRST_SLAB 64
+
+struct chip8_pool_slab {
+  struct chip8_pool_slab *next;
+  chip8 *machines;
+  int count;
+};
+
+void chip8_fork(const chip8 *src, chip8 *dst) {
+  // only the chunks either side wrote can differ
+  for (int w=0; w<CHIP8_MEM_SIZE/64; w++) {
+    uint64_t bits = src->written[w] | dst->written[w];
+    if (bits == 0) continue;
+
+    if (dst->cache != NULL || dst->jit != NULL) {
+      for (int b=0; bits != 0; b++, bits >>= 1) {
+        word addr = w*64 + b;
+        if (!(bits & 1) || dst->mem[addr] == src->mem[addr]) continue;
+        if (dst->cache != NULL) chip8_cache_invalidate(dst->cache, addr);
+        if (dst->jit != NULL) chip8_jit_invalidate(dst->jit, addr);
+      }
+    }
+    memcpy(dst->mem + w*64, src->mem + w*64, 64);
+  }
+  memcpy(dst->written, src->written, sizeof(dst->written));
+
+  memcpy(dst->R, src->R, sizeof(dst->R));
+  dst->I = src->I;
+  dst->SP = src->SP;
+  memcpy(dst->stack, src->stack, sizeof(dst->stack));
+  dst->PC = src->PC;
+  dst->timer = src->timer;
+  dst->sound = src->sound;
+  dst->rng = src->rng;
+
+  memcpy(dst->screen, src->screen, sizeof(dst->screen));
+  dst->dirty_rows = src->dirty_rows;
+  dst->screen_changed = src->screen_changed;
+  memcpy(dst->keys, src->keys, sizeof(dst->keys));
+
+  dst->waserror = src->waserror;
+  if (src->waserror) strcpy(dst->errormsg, src->errormsg);
+  dst->quit = src->quit;
+
+  if (dst->core != src->core) {
+    // starts dst's caches over, they have the old quirks baked in
+    dst->core = src->core;
+    chip8_threaded_reset(dst);
+    chip8_jit_reset(dst);
+  }
+  dst->stop = src->stop;
+
+  dst->cycles = src->cycles;
+  dst->ticks = src->ticks;
+  dst->cycles_per_tick = src->cycles_per_tick;
+  dst->tick_cycles_left = src->tick_cycles_left;
+  dst->idle_cycles = src->idle_cycles;
+
+  // compiled-in blocks are never written to, so they can be shared
+  dst->aot = src->aot;
+}
+
+chip8_pool *chip8_pool_create(const chip8 *root) {
+  chip8_pool *pool = malloc(sizeof(chip8_pool));
+  if (pool == NULL) return NULL;
+  pool->root = root;
+  pool->free = NULL;
+  pool->nFree = 0;
+  pool->slabs = NULL;
+  pool->total = 0;
+  return pool;
+}
+
+void chip8_pool_destroy(chip8_pool *pool) {
+  if (pool == NULL) return;
+  struct chip8_pool_slab *slab = pool->slabs;
+  while (slab != NULL) {
+    struct chip8_pool_slab *next = slab->next;
+    chip8_aligned_free(slab->machines);
+    free(slab);
+    slab = next;
+  }
+  free(pool->free);
+  free(pool);
+}
+
+// Another slab as big as all the others together
+static bool pool_grow(chip8_pool *pool) {
+  int count = pool->total > 0 ? pool->total : FIRST_SLAB;
+
+  // room to hand every machine back
+  chip8 **freeList = realloc(pool->free, (pool->total + count) * sizeof(chip8*));
+  if (freeList == NULL) return false;
+  pool->free = freeList;
+
+  struct chip8_pool_slab *slab = malloc(sizeof(struct chip8_pool_slab));
+  if (slab == NULL) return false;
+
+  slab->machines = chip8_aligned_alloc(count * sizeof(chip8));
+  if (slab->machines == NULL) {
+    free(slab);
+    return false;
+  }
+  slab->count = count;
+
+  for (int i=0; i<count; i++) {
+    chip8 *ch8 = &slab->machines[i];
+    // the one time the whole thing gets copied
+    memcpy(ch8, pool->root, sizeof(chip8));
+    ch8->cache = NULL;
+    ch8->jit = NULL;
+    pool->free[pool->nFree++] = ch8;
+  }
+
+  slab->next = pool->slabs;
+  pool->slabs = slab;
+  pool->total += count;
+  return true;
+}
+
+chip8 *chip8_pool_alloc(chip8_pool *pool) {
+  if (pool->nFree == 0 && !pool_grow(pool)) return NULL;
+  return pool->free[--pool->nFree];
+}
+
+chip8 *chip8_pool_fork(chip8_pool *pool, const chip8 *src) {
+  chip8 *ch8 = chip8_pool_alloc(pool);
+  if (ch8 != NULL) chip8_fork(src, ch8);
+  return ch8;
+}
+
+void chip8_pool_release(chip8_pool *pool, chip8 *ch8) {
+  pool->free[pool->nFree++] = ch8;
+}
@@ -0,0 +1,34 @@
+#include "quirks.h"
+
+#include <string.h>
+
+const char *chip8_profile_names[CHIP8_PROFILE_COUNT] = {
+  [CHIP8_PROFILE_DEFAULT] = "default",
+  [CHIP8_PROFILE_COSMAC] = "cosmac",
+  [CHIP8_PROFILE_SCHIP] = "schip",
+  [CHIP8_PROFILE_XOCHIP] = "xochip",
+};
+
+const int chip8_profile_quirks[CHIP8_PROFILE_COUNT] = {
+  [CHIP8_PROFILE_DEFAULT] = CHIP8_QUIRKS_DEFAULT,
+  [CHIP8_PROFILE_COSMAC] = CHIP8_QUIRKS_COSMAC,
+  [CHIP8_PROFILE_SCHIP] = CHIP8_QUIRKS_SCHIP,
+  [CHIP8_PROFILE_XOCHIP] = CHIP8_QUIRKS_XOCHIP,
+};
+
+chip8_profile chip8_guess_profile(const char *filename) {
+  const char *ext = strrchr(filename, '.');
+  if (ext == NULL) return CHIP8_PROFILE_DEFAULT;
+
+  if (strcmp(ext, ".ch8") == 0) return CHIP8_PROFILE_COSMAC;
+  if (strcmp(ext, ".sc8") == 0) return CHIP8_PROFILE_SCHIP;
+  if (strcmp(ext, ".xo8") == 0) return CHIP8_PROFILE_XOCHIP;
+  return CHIP8_PROFILE_DEFAULT;
+}
+
+chip8_profile chip8_profile_by_name(const char *name) {
+  for (int i=0; i<CHIP8_PROFILE_COUNT; i++) {
+    if (strcmp(name, chip8_profile_names[i]) == 0) return i;
+  }
+  return CHIP8_PROFILE_COUNT;
+}
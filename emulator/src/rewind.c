@@ -0,0 +1,196 @@
+#include "rewind.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define STATE_SIZE sizeof(chip8_savestate)
+
+// Zero runs shorter than this are kept in with the bytes around them,
+// so no frame is ever more than RUN_HEADER bytes bigger than a state.
+#define RUN_HEADER 4
+#define MAX_FRAME_SIZE (STATE_SIZE + RUN_HEADER)
+
+chip8_rewind *chip8_rewind_create(uint32_t frames, uint32_t bytes) {
+  if (frames == 0 || bytes < 4 * MAX_FRAME_SIZE) return NULL;
+
+  chip8_rewind *rw = chip8_aligned_alloc(sizeof(chip8_rewind));
+  if (rw == NULL) return NULL;
+
+  rw->data = malloc(bytes);
+  rw->frames = malloc(frames * sizeof(chip8_rewind_frame));
+  if (rw->data == NULL || rw->frames == NULL) {
+    chip8_rewind_destroy(rw);
+    return NULL;
+  }
+
+  rw->size = bytes;
+  rw->end = 0;
+  rw->capacity = frames;
+  rw->first = rw->next = 0;
+  rw->key_valid = false;
+  // chip8_snapshot zeroes the padding in a state, so it XORs away to nothing
+  memset(&rw->key, 0, STATE_SIZE);
+  memset(&rw->scratch, 0, STATE_SIZE);
+  return rw;
+}
+
+void chip8_rewind_destroy(chip8_rewind *rw) {
+  if (rw == NULL) return;
+  free(rw->data);
+  free(rw->frames);
+  chip8_aligned_free(rw);
+}
+
+// what keyframes are XORed with
+static const chip8_savestate zero;
+
+// Writes the XOR of a and b as runs of
+//   u16 zero bytes skipped, u16 length, that many bytes
+// and returns how long it came out.
+static uint32_t encode(const byte *a, const byte *b, byte *out) {
+  byte *o = out;
+  uint32_t i = 0, skipped = 0;
+  while (i < STATE_SIZE) {
+    // most of it is the same, so skip ahead a word at a time
+    uint64_t wa, wb;
+    if (i % 8 == 0 && i + 8 <= STATE_SIZE) {
+      memcpy(&wa, a+i, 8);
+      memcpy(&wb, b+i, 8);
+      if (wa == wb) {
+        i += 8;
+        skipped += 8;
+        continue;
+      }
+    }
+    if (a[i] == b[i]) {
+      i++;
+      skipped++;
+      continue;
+    }
+
+    // a run of bytes, until a long enough stretch of zeros
+    byte *header = o;
+    o += RUN_HEADER;
+    uint32_t zeros = 0;
+    uint32_t start = i;
+    while (i < STATE_SIZE && zeros < RUN_HEADER) {
+      byte x = a[i] ^ b[i];
+      zeros = x == 0 ? zeros + 1 : 0;
+      *o++ = x;
+      i++;
+    }
+    // the zeros at the end start the next skip
+    o -= zeros;
+    uint32_t length = i - start - zeros;
+
+    header[0] = skipped;
+    header[1] = skipped >> 8;
+    header[2] = length;
+    header[3] = length >> 8;
+    skipped = zeros;
+  }
+  return o - out;
+}
+
+// XORs an encoded frame into state
+static void decode(byte *state, const byte *in, uint32_t length) {
+  const byte *end = in + length;
+  uint32_t i = 0;
+  while (in < end) {
+    i += in[0] | in[1] << 8;
+    uint32_t n = in[2] | in[3] << 8;
+    in += RUN_HEADER;
+    for (uint32_t k=0; k<n; k++) state[i+k] ^= in[k];
+    i += n;
+    in += n;
+  }
+}
+
+static chip8_rewind_frame *frame(chip8_rewind *rw, uint64_t n) {
+  return &rw->frames[n % rw->capacity];
+}
+
+// Forgets the oldest keyframe and the frames stored against it
+static void drop_oldest(chip8_rewind *rw) {
+  uint64_t key = frame(rw, rw->first)->keyframe;
+  while (rw->first < rw->next && frame(rw, rw->first)->keyframe == key) {
+    rw->first++;
+  }
+  if (key == rw->key_frame) rw->key_valid = false;
+  if (rw->first == rw->next) rw->end = 0;
+}
+
+// Where the next frame can go, making room for the biggest it could be
+static uint32_t make_room(chip8_rewind *rw) {
+  for (;;) {
+    if (rw->first == rw->next) return 0;
+
+    uint32_t start = frame(rw, rw->first)->offset;
+    bool wrapped = start >= rw->end;
+    if (rw->end + MAX_FRAME_SIZE <= rw->size) {
+      if (!wrapped || rw->end + MAX_FRAME_SIZE <= start) return rw->end;
+    } else if (!wrapped && MAX_FRAME_SIZE <= start) {
+      return 0;
+    }
+    drop_oldest(rw);
+  }
+}
+
+void chip8_rewind_push(chip8_rewind *rw, const chip8 *ch8) {
+  if (chip8_rewind_count(rw) == rw->capacity) drop_oldest(rw);
+  uint32_t offset = make_room(rw);
+
+  bool keyframe = !rw->key_valid || rw->next - rw->key_frame >= CHIP8_REWIND_KEYFRAME_INTERVAL;
+  chip8_savestate *st = keyframe ? &rw->key : &rw->scratch;
+  chip8_snapshot(ch8, st);
+
+  chip8_rewind_frame *f = frame(rw, rw->next);
+  f->offset = offset;
+  if (keyframe) {
+    f->length = encode((const byte*)st, (const byte*)&zero, rw->data + offset);
+    rw->key_frame = rw->next;
+    rw->key_valid = true;
+  } else {
+    f->length = encode((const byte*)st, (const byte*)&rw->key, rw->data + offset);
+  }
+  f->keyframe = rw->key_frame;
+
+  rw->end = offset + f->length;
+  rw->next++;
+}
+
+bool chip8_rewind_pop(chip8_rewind *rw, chip8 *ch8) {
+  if (rw->first == rw->next) return false;
+
+  uint64_t n = rw->next - 1;
+  chip8_rewind_frame *f = frame(rw, n);
+
+  // the frames before this one are stored against the same keyframe,
+  // or against one further back that's still in the ring
+  if (!rw->key_valid || rw->key_frame != f->keyframe) {
+    chip8_rewind_frame *k = frame(rw, f->keyframe);
+    memset(&rw->key, 0, STATE_SIZE);
+    decode((byte*)&rw->key, rw->data + k->offset, k->length);
+    rw->key_frame = f->keyframe;
+    rw->key_valid = true;
+  }
+
+  if (n == f->keyframe) {
+    chip8_restore(ch8, &rw->key);
+    // the next push starts a new keyframe
+    rw->key_valid = false;
+  } else {
+    memcpy(&rw->scratch, &rw->key, STATE_SIZE);
+    decode((byte*)&rw->scratch, rw->data + f->offset, f->length);
+    chip8_restore(ch8, &rw->scratch);
+  }
+
+  rw->next = n;
+  if (rw->first == rw->next) {
+    rw->end = 0;
+  } else {
+    chip8_rewind_frame *prev = frame(rw, n - 1);
+    rw->end = prev->offset + prev->length;
+  }
+  return true;
+}
@@ -0,0 +1,27 @@
+#include "screenbuf.h"
+
+#include <string.h>
+
+void chip8_screenbuf_init(chip8_screenbuf *buf) {
+  memset(buf->screen, 0, sizeof(buf->screen));
+  buf->back = 0;
+  atomic_init(&buf->middle, 1);
+  buf->front = 2;
+}
+
+void chip8_screenbuf_publish(chip8_screenbuf *buf, const chip8 *ch8) {
+  memcpy(buf->screen[buf->back], ch8->screen, sizeof(ch8->screen));
+  // release, so the reader sees the rows once it sees the index
+  unsigned old = atomic_exchange_explicit(&buf->middle,
+    buf->back | CHIP8_SCREENBUF_FRESH, memory_order_acq_rel);
+  buf->back = old & 3;
+}
+
+const uint64_t *chip8_screenbuf_acquire(chip8_screenbuf *buf) {
+  if (!(atomic_load_explicit(&buf->middle, memory_order_relaxed) & CHIP8_SCREENBUF_FRESH)) {
+    return NULL;
+  }
+  unsigned old = atomic_exchange_explicit(&buf->middle, buf->front, memory_order_acq_rel);
+  buf->front = old & 3;
+  return buf->screen[buf->front];
+}
@@ -0,0 +1,95 @@
+#include "snapshot.h"
+#include "quirks.h"
+#include "threaded.h"
+#include "jit.h"
+
+#include <string.h>
+
+void chip8_snapshot(const chip8 *ch8, chip8_savestate *st) {
+  // zero the padding too, so two snapshots of the same machine are the
+  // same bytes and nothing left over in st ends up in a saved file
+  memset(st, 0, sizeof(*st));
+
+  memcpy(st->mem, ch8->mem, sizeof(st->mem));
+  memcpy(st->screen, ch8->screen, sizeof(st->screen));
+  memcpy(st->written, ch8->written, sizeof(st->written));
+
+  st->rng = ch8->rng;
+  st->cycles = ch8->cycles;
+  st->idle_cycles = ch8->idle_cycles;
+  st->ticks = ch8->ticks;
+  st->cycles_per_tick = ch8->cycles_per_tick;
+  st->tick_cycles_left = ch8->tick_cycles_left;
+
+  st->version = CHIP8_SAVESTATE_VERSION;
+
+  memcpy(st->stack, ch8->stack, sizeof(st->stack));
+  st->I = ch8->I;
+  st->SP = ch8->SP;
+  st->PC = ch8->PC;
+  memcpy(st->R, ch8->R, sizeof(st->R));
+  st->timer = ch8->timer;
+  st->sound = ch8->sound;
+  memcpy(st->keys, ch8->keys, sizeof(st->keys));
+  st->quit = ch8->quit;
+  st->profile = ch8->core - chip8_cores;
+}
+
+// Tells the decode caches about every byte that's about to change. Bytes
+// neither side has written since the ROM was loaded are the same in both.
+static void restore_code(chip8 *ch8, const chip8_savestate *st) {
+  for (int w=0; w<CHIP8_MEM_SIZE/64; w++) {
+    uint64_t bits = ch8->written[w] | st->written[w];
+    for (int b=0; bits != 0; b++, bits >>= 1) {
+      word addr = w*64 + b;
+      if (!(bits & 1) || ch8->mem[addr] == st->mem[addr]) continue;
+      if (ch8->cache != NULL) chip8_cache_invalidate(ch8->cache, addr);
+      if (ch8->jit != NULL) chip8_jit_invalidate(ch8->jit, addr);
+    }
+  }
+}
+
+bool chip8_restore(chip8 *ch8, const chip8_savestate *st) {
+  if (st->version != CHIP8_SAVESTATE_VERSION || st->profile >= CHIP8_PROFILE_COUNT) {
+    return false;
+  }
+
+  if (&chip8_cores[st->profile] != ch8->core) {
+    // starts the caches over anyway
+    chip8_set_profile(ch8, st->profile);
+  } else if (ch8->cache != NULL || ch8->jit != NULL) {
+    restore_code(ch8, st);
+  }
+
+  for (int y=0; y<CHIP8_SCREEN_H; y++) {
+    if (ch8->screen[y] != st->screen[y]) {
+      ch8->dirty_rows |= (uint32_t)1 << y;
+      ch8->screen_changed = true;
+    }
+  }
+
+  memcpy(ch8->mem, st->mem, sizeof(ch8->mem));
+  memcpy(ch8->screen, st->screen, sizeof(ch8->screen));
+  memcpy(ch8->written, st->written, sizeof(ch8->written));
+
+  ch8->rng = st->rng;
+  ch8->cycles = st->cycles;
+  ch8->idle_cycles = st->idle_cycles;
+  ch8->ticks = st->ticks;
+  ch8->cycles_per_tick = st->cycles_per_tick;
+  ch8->tick_cycles_left = st->tick_cycles_left;
+
+  memcpy(ch8->stack, st->stack, sizeof(ch8->stack));
+  ch8->I = st->I;
+  ch8->SP = st->SP;
+  ch8->PC = st->PC;
+  memcpy(ch8->R, st->R, sizeof(ch8->R));
+  ch8->timer = st->timer;
+  ch8->sound = st->sound;
+  memcpy(ch8->keys, st->keys, sizeof(ch8->keys));
+
+  ch8->quit = st->quit;
+  ch8->waserror = false;
+  ch8->stop = CHIP8_STOP_NONE;
+  return true;
+}
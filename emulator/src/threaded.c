@@ -0,0 +1,151 @@
+#include "threaded.h"
+#include "ops.h"
+#include "idle.h"
+#include "quirks.h"
+
+#include <stdlib.h>
+
+#ifndef CHIP8_COMPUTED_GOTO
+#if defined(__GNUC__)
+#define CHIP8_COMPUTED_GOTO 1
+#else
+#define CHIP8_COMPUTED_GOTO 0
+#endif
+#endif
+
+// extra ops that only exist inside the cache
+#define OP_UNDECODED CHIP8_OP_COUNT // not decoded yet (or overwritten since)
+#define OP_SLOW (CHIP8_OP_COUNT+1)  // let chip8_step deal with it
+
+// superinstructions: the first instruction of a common sequence gets one
+// of these ops, the rest of the sequence stays decoded as it was
+#define OP_IFNEQ_JUMP (CHIP8_OP_COUNT+2)   // IFNEQ RX, NN / JUMP NNN
+#define OP_IFEQ_JUMP (CHIP8_OP_COUNT+3)    // IFEQ RX, NN / JUMP NNN
+#define OP_SET_SET_DRAW (CHIP8_OP_COUNT+4) // SET RX, NN / SET RY, NN / DRAW
+#define OP_SET_I_DRAW (CHIP8_OP_COUNT+5)   // SET I, NNN / DRAW
+#define OP_MAX (CHIP8_OP_COUNT+6)
+
+// longest sequence, in bytes
+#define FUSED_MAX_SIZE 6
+
+static const chip8_instr undecoded = { .op = OP_UNDECODED };
+static const chip8_instr slow = { .op = OP_SLOW };
+
+bool chip8_threaded_enable(chip8 *ch8) {
+  if (ch8->cache == NULL) {
+    ch8->cache = malloc(sizeof(struct chip8_cache));
+    if (ch8->cache == NULL) {
+      return false;
+    }
+  }
+
+  chip8_threaded_reset(ch8);
+  return true;
+}
+
+void chip8_threaded_disable(chip8 *ch8) {
+  free(ch8->cache);
+  ch8->cache = NULL;
+}
+
+static inline bool chip8_is_fused(byte op) {
+  return op >= OP_IFNEQ_JUMP && op < OP_MAX;
+}
+
+// Turns the instruction at addr into a superinstruction if it starts one
+// of the sequences above. Only its op changes, so a jump into the middle
+// of the sequence still finds the plain instruction it expects.
+static void chip8_cache_fuse(struct chip8_cache *cache, word addr) {
+  if (addr+4 >= CHIP8_MEM_SIZE-1) return;
+
+  chip8_instr *in = &cache->code[addr];
+  byte next = cache->code[addr+2].op;
+  byte after = cache->code[addr+4].op;
+
+  if (in->op == CHIP8_OP_IFNEQ && next == CHIP8_OP_JUMP) {
+    in->op = OP_IFNEQ_JUMP;
+  } else if (in->op == CHIP8_OP_IFEQ && next == CHIP8_OP_JUMP) {
+    in->op = OP_IFEQ_JUMP;
+  } else if (in->op == CHIP8_OP_SET && next == CHIP8_OP_SET && after == CHIP8_OP_DRAW) {
+    in->op = OP_SET_SET_DRAW;
+  } else if (in->op == CHIP8_OP_SET_I && next == CHIP8_OP_DRAW) {
+    in->op = OP_SET_I_DRAW;
+  }
+}
+
+void chip8_threaded_reset(chip8 *ch8) {
+  struct chip8_cache *cache = ch8->cache;
+  if (cache == NULL) return;
+
+  // the hex sprites are data, no point decoding them
+  for (int i=0; i<CHIP8_PROGRAM_START_ADDRESS; i++) {
+    cache->code[i] = undecoded;
+  }
+
+  for (int i=CHIP8_PROGRAM_START_ADDRESS; i<CHIP8_MEM_SIZE-1; i++) {
+    cache->code[i] = chip8_decode_table[(ch8->mem[i] << 8) | ch8->mem[i+1]];
+  }
+
+  // the last byte only has half an instruction in it
+  cache->code[CHIP8_MEM_SIZE-1] = slow;
+
+  for (int i=CHIP8_PROGRAM_START_ADDRESS; i<CHIP8_MEM_SIZE-1; i++) {
+    chip8_cache_fuse(cache, i);
+  }
+}
+
+void chip8_cache_invalidate(struct chip8_cache *cache, word addr) {
+  // the byte is the high half of the instruction at addr,
+  // and the low half of the one just before it
+  if (addr < CHIP8_MEM_SIZE-1) cache->code[addr] = undecoded;
+  if (addr > 0) cache->code[addr-1] = undecoded;
+
+  // and maybe part of a sequence that starts a bit before it
+  for (int i=addr-FUSED_MAX_SIZE+1; i<addr-1; i++) {
+    if (i >= 0 && chip8_is_fused(cache->code[i].op)) {
+      cache->code[i] = undecoded;
+    }
+  }
+}
+
+static inline const chip8_instr *chip8_cache_fetch(chip8 *ch8, struct chip8_cache *cache) {
+  word pc = ch8->PC;
+  if (pc >= CHIP8_MEM_SIZE-1) {
+    // out of bounds, chip8_step will report the error
+    return &slow;
+  }
+
+  chip8_instr *in = &cache->code[pc];
+  if (in->op == OP_UNDECODED) {
+    *in = chip8_decode_table[(ch8->mem[pc] << 8) | ch8->mem[pc+1]];
+  }
+  return in;
+}
+
+#define CORE_NAME chip8_default_
+#define CORE_QUIRKS CHIP8_QUIRKS_DEFAULT
+#include "threaded_core.h"
+
+#define CORE_NAME chip8_cosmac_
+#define CORE_QUIRKS CHIP8_QUIRKS_COSMAC
+#include "threaded_core.h"
+
+#define CORE_NAME chip8_schip_
+#define CORE_QUIRKS CHIP8_QUIRKS_SCHIP
+#include "threaded_core.h"
+
+#define CORE_NAME chip8_xochip_
+#define CORE_QUIRKS CHIP8_QUIRKS_XOCHIP
+#include "threaded_core.h"
+
+// indexed by chip8_profile, like chip8_cores
+static uint32_t (*const chip8_threaded_runs[CHIP8_PROFILE_COUNT])(chip8*, uint32_t) = {
+  [CHIP8_PROFILE_DEFAULT] = chip8_default_threaded_run,
+  [CHIP8_PROFILE_COSMAC] = chip8_cosmac_threaded_run,
+  [CHIP8_PROFILE_SCHIP] = chip8_schip_threaded_run,
+  [CHIP8_PROFILE_XOCHIP] = chip8_xochip_threaded_run,
+};
+
+uint32_t chip8_threaded_run(chip8 *ch8, uint32_t cycles) {
+  return chip8_threaded_runs[ch8->core - chip8_cores](ch8, cycles);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// Runs many ROMs at once on a pool of threads.
+//
+// The job file has one job per line: a ROM path, optionally followed by a
+// key script path. Lines starting with '#' are comments. Every job uses
+// the same run_options.
+//
+// The results file is little-endian binary:
+//
+//   header: "CH8R", u32 version (1), u32 job count, u32 record size (32)
+//   then one record per job, in job file order:
+//     u64 chip8_hash of the final state
+//     u64 cycles run
+//     u64 frames (timer ticks) run
+//     u8  status, see batch_status
+//     7 bytes of zero padding
+//
+// Error messages go to stderr as "<job file>:<line>: <message>".
+
+#include "run.h"
+
+#define BATCH_RESULTS_VERSION 1
+#define BATCH_RECORD_SIZE 32
+
+typedef enum {
+  BATCH_OK,    // hit the cycle or frame limit
+  BATCH_QUIT,  // ran into BREAK
+  BATCH_ERROR, // stopped with an error, or couldn't start
+} batch_status;
+
+// threads = 0 uses one per CPU. Returns the number of jobs that failed,
+// or -1 if the job file couldn't be read or the results written.
+int run_batch(const char *jobPath, const char *outPath, int threads, const run_options *options);
@@ -0,0 +1,58 @@
+#pragma once
+
+// Running one ROM without a window, shared by single runs and batches.
+
+#include "chip8.h"
+#include "quirks.h"
+#include "movie.h"
+
+// with no cycle or frame limit, stop after this many frames (10 seconds)
+#define DEFAULT_FRAMES 600
+
+// the keys held from `frame` on
+typedef struct {
+  uint64_t frame;
+  bool keys[16];
+} key_event;
+
+typedef enum {
+  ENGINE_BEST, // the recompiler if it works here, else threaded
+  ENGINE_STEP,
+  ENGINE_THREADED,
+  ENGINE_JIT,
+  ENGINE_LANES, // batches only: jobs on the same ROM run side by side, see lanes.h
+} run_engine;
+
+typedef struct {
+  run_engine engine;
+  chip8_profile profile; // CHIP8_PROFILE_COUNT to guess from the extension
+  uint64_t max_cycles;   // UINT64_MAX for no limit
+  uint64_t max_frames;   // same
+  uint32_t cycles_per_tick;
+  uint64_t seed;         // for CXNN, see chip8_seed
+} run_options;
+
+byte *load_rom_from_file(const char *path, long *len);
+
+// One event per line: a frame number, then the keys held from then on
+// as hex digits, or "-" for none. Lines starting with '#' are comments.
+//
+//   # press 5 for a second, then 4 and 6 together
+//   60 5
+//   120 -
+//   180 46
+//
+// Returns NULL with the reason in `error` (256 bytes) if it can't be read.
+key_event *load_key_script(const char *path, int *count, char *error);
+
+// Starts ch8 on the ROM at `path` with the profile and engine from `options`.
+// On failure ch8 has stopped with an error, see errormsg.
+bool run_setup(chip8 *ch8, const char *path, const run_options *options);
+
+// Runs until the machine stops or hits a limit, pressing keys as it goes,
+// and recording them into `record` unless that's NULL.
+void run_frames(chip8 *ch8, const run_options *options, const key_event *events, int nEvents, chip8_movie *record);
+
+// Plays a movie (already started with chip8_movie_play_start) until it
+// ends, the machine stops or it hits a limit from options.
+void run_movie(chip8 *ch8, const run_options *options, chip8_movie *movie);
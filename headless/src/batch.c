@@ -0,0 +1,448 @@
+#include "batch.h"
+#include "decode.h"
+#include "lanes.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct {
+  char *rom;
+  char *keys; // NULL for none
+  int line;
+} batch_job;
+
+typedef struct {
+  uint64_t hash, cycles, ticks;
+  uint64_t idle_cycles; // of cycles, see idle.h
+  batch_status status;
+  char *error; // NULL unless status is BATCH_ERROR
+} batch_result;
+
+// Each worker owns a range of groups of jobs (one job each, unless the
+// lanes engine puts jobs on the same ROM together). It takes them from
+// the front, and when it runs dry it steals the back half of somebody
+// else's range.
+typedef struct {
+  pthread_mutex_t lock;
+  int next, end;
+} batch_queue;
+
+typedef struct {
+  const batch_job *jobs;
+  const int *groups; // group g is jobs groups[g] up to groups[g+1]
+  batch_result *results;
+  const run_options *options;
+  batch_queue *queues;
+  int nQueues;
+} batch_pool;
+
+typedef struct {
+  batch_pool *pool;
+  int index;
+  bool started; // has a thread of its own to join
+} batch_worker;
+
+static int cpu_count(void) {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? n : 1;
+#endif
+}
+
+static double seconds_now(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void free_jobs(batch_job *jobs, int count) {
+  for (int i=0; i<count; i++) {
+    free(jobs[i].rom);
+    free(jobs[i].keys);
+  }
+  free(jobs);
+}
+
+// Returns the job list, or NULL (and prints why) if the file can't be read
+static batch_job *load_jobs(const char *path, int *count) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    printf("Failed to read job file '%s'\n", path);
+    return NULL;
+  }
+
+  int n = 0, capacity = 256;
+  batch_job *jobs = malloc(capacity * sizeof(batch_job));
+  if (jobs == NULL) {
+    printf("Out of memory reading job file '%s'\n", path);
+    fclose(fp);
+    return NULL;
+  }
+
+  char line[1024];
+  int lineno = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), fp)) {
+    lineno++;
+    if (line[0] == '#') continue;
+
+    char rom[512], keys[512];
+    int fields = sscanf(line, "%511s %511s", rom, keys);
+    if (fields < 1) continue;
+
+    if (n == capacity) {
+      batch_job *bigger = realloc(jobs, capacity * 2 * sizeof(batch_job));
+      if (bigger == NULL) {
+        ok = false;
+        break;
+      }
+      jobs = bigger;
+      capacity *= 2;
+    }
+
+    batch_job *job = &jobs[n++];
+    job->rom = strdup(rom);
+    job->keys = fields > 1 ? strdup(keys) : NULL;
+    job->line = lineno;
+    ok = job->rom != NULL && (fields == 1 || job->keys != NULL);
+  }
+
+  if (!ok) {
+    printf("Out of memory reading job file '%s'\n", path);
+    fclose(fp);
+    free_jobs(jobs, n);
+    return NULL;
+  }
+
+  fclose(fp);
+  *count = n;
+  return jobs;
+}
+
+static void run_job(chip8 *ch8, const batch_job *job, const run_options *options, batch_result *result) {
+  int nEvents = 0;
+  key_event *events = NULL;
+  char error[256];
+
+  if (job->keys != NULL && (events = load_key_script(job->keys, &nEvents, error)) == NULL) {
+    // report it like any other error
+    chip8_init(ch8);
+    chip8_error(ch8, error);
+  } else if (run_setup(ch8, job->rom, options)) {
+    run_frames(ch8, options, events, nEvents, NULL);
+  }
+
+  result->hash = chip8_hash(ch8);
+  result->cycles = ch8->cycles;
+  result->ticks = ch8->ticks;
+  result->idle_cycles = ch8->idle_cycles;
+  if (ch8->waserror) {
+    result->status = BATCH_ERROR;
+    result->error = strdup(ch8->errormsg);
+  } else {
+    result->status = ch8->quit ? BATCH_QUIT : BATCH_OK;
+    result->error = NULL;
+  }
+
+  free(events);
+  chip8_quit(ch8);
+}
+
+static void lanes_result(const chip8 *ch8, batch_result *result) {
+  result->hash = chip8_hash(ch8);
+  result->cycles = ch8->cycles;
+  result->ticks = ch8->ticks;
+  result->idle_cycles = ch8->idle_cycles;
+  if (ch8->waserror) {
+    result->status = BATCH_ERROR;
+    result->error = strdup(ch8->errormsg);
+  } else {
+    result->status = ch8->quit ? BATCH_QUIT : BATCH_OK;
+    result->error = NULL;
+  }
+}
+
+// Runs jobs that share a ROM together on one chip8_lanes, frame by frame
+// like run_frames. A job on its own, or any that can't start that way,
+// runs through run_job instead.
+static void run_lanes(chip8 *ch8, const batch_job *jobs, int count, const run_options *options, batch_result *results) {
+  long length;
+  byte *rom = load_rom_from_file(jobs[0].rom, &length);
+  chip8_lanes *lanes = count > 1 && rom != NULL ? chip8_lanes_create(count) : NULL;
+  if (lanes == NULL || !chip8_lanes_loadrom(lanes, rom, length)) {
+    // run_job says what went wrong
+    for (int i=0; i<count; i++) run_job(ch8, &jobs[i], options, &results[i]);
+    chip8_lanes_destroy(lanes);
+    free(rom);
+    return;
+  }
+  free(rom);
+
+  chip8_profile profile = options->profile;
+  if (profile == CHIP8_PROFILE_COUNT) {
+    profile = chip8_guess_profile(jobs[0].rom);
+  }
+  chip8_lanes_set_profile(lanes, profile);
+
+  key_event *events[CHIP8_LANES] = {0};
+  int nEvents[CHIP8_LANES] = {0}, nextEvent[CHIP8_LANES] = {0};
+  for (int l=0; l<count; l++) {
+    chip8 *lane = &lanes->lane[l];
+    chip8_set_cycles_per_tick(lane, options->cycles_per_tick);
+    chip8_seed(lane, options->seed);
+
+    char error[256];
+    if (jobs[l].keys != NULL && (events[l] = load_key_script(jobs[l].keys, &nEvents[l], error)) == NULL) {
+      // leave this lane out, as if it had quit
+      run_job(ch8, &jobs[l], options, &results[l]);
+      lane->quit = true;
+    }
+  }
+
+  uint64_t max_cycles = options->max_cycles;
+  uint64_t max_frames = options->max_frames;
+  if (max_cycles == UINT64_MAX && max_frames == UINT64_MAX) {
+    max_frames = DEFAULT_FRAMES;
+  }
+
+  // the lanes that haven't quit all share one clock, so follow the first
+  while (true) {
+    chip8 *clock = NULL;
+    for (int l=0; l<count && clock == NULL; l++) {
+      if (!lanes->lane[l].quit) clock = &lanes->lane[l];
+    }
+    if (clock == NULL || clock->ticks >= max_frames || clock->cycles >= max_cycles) break;
+
+    for (int l=0; l<count; l++) {
+      while (nextEvent[l] < nEvents[l] && events[l][nextEvent[l]].frame <= clock->ticks) {
+        memcpy(lanes->lane[l].keys, events[l][nextEvent[l]].keys, sizeof(lanes->lane[l].keys));
+        nextEvent[l]++;
+      }
+    }
+
+    uint32_t budget = chip8_cycles_until_tick(clock);
+    if (budget > max_cycles - clock->cycles) budget = max_cycles - clock->cycles;
+    chip8_lanes_run(lanes, budget);
+  }
+
+  for (int l=0; l<count; l++) {
+    if (events[l] != NULL || jobs[l].keys == NULL) lanes_result(&lanes->lane[l], &results[l]);
+    free(events[l]);
+  }
+  chip8_lanes_destroy(lanes);
+}
+
+// Takes the next group from our own range, or steals some. -1 when all done.
+static int next_group(batch_pool *pool, int self) {
+  batch_queue *own = &pool->queues[self];
+
+  pthread_mutex_lock(&own->lock);
+  if (own->next < own->end) {
+    int job = own->next++;
+    pthread_mutex_unlock(&own->lock);
+    return job;
+  }
+  pthread_mutex_unlock(&own->lock);
+
+  // nothing new ever gets queued, so one empty pass means we're done
+  for (int i=1; i<pool->nQueues; i++) {
+    batch_queue *victim = &pool->queues[(self + i) % pool->nQueues];
+
+    pthread_mutex_lock(&victim->lock);
+    int left = victim->end - victim->next;
+    if (left <= 0) {
+      pthread_mutex_unlock(&victim->lock);
+      continue;
+    }
+    int end = victim->end;
+    int start = end - (left+1) / 2;
+    victim->end = start;
+    pthread_mutex_unlock(&victim->lock);
+
+    // run the first one now, keep the rest where others can steal them
+    pthread_mutex_lock(&own->lock);
+    own->next = start+1;
+    own->end = end;
+    pthread_mutex_unlock(&own->lock);
+    return start;
+  }
+
+  return -1;
+}
+
+static void *worker_main(void *arg) {
+  batch_worker *worker = arg;
+  batch_pool *pool = worker->pool;
+
+  // reused for every job, on the stack since it wants 64-byte alignment
+  chip8 ch8;
+
+  int group;
+  while ((group = next_group(pool, worker->index)) >= 0) {
+    int first = pool->groups[group], count = pool->groups[group+1] - first;
+    if (pool->options->engine == ENGINE_LANES) {
+      run_lanes(&ch8, &pool->jobs[first], count, pool->options, &pool->results[first]);
+    } else {
+      run_job(&ch8, &pool->jobs[first], pool->options, &pool->results[first]);
+    }
+  }
+
+  return NULL;
+}
+
+static void put_u32(FILE *fp, uint32_t v) {
+  for (int i=0; i<4; i++) fputc((v >> (i*8)) & 0xFF, fp);
+}
+
+static void put_u64(FILE *fp, uint64_t v) {
+  for (int i=0; i<8; i++) fputc((v >> (i*8)) & 0xFF, fp);
+}
+
+static bool write_results(const char *path, const batch_result *results, int count) {
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL) return false;
+
+  fputs("CH8R", fp);
+  put_u32(fp, BATCH_RESULTS_VERSION);
+  put_u32(fp, count);
+  put_u32(fp, BATCH_RECORD_SIZE);
+
+  for (int i=0; i<count; i++) {
+    put_u64(fp, results[i].hash);
+    put_u64(fp, results[i].cycles);
+    put_u64(fp, results[i].ticks);
+    fputc(results[i].status, fp);
+    for (int j=0; j<7; j++) fputc(0, fp);
+  }
+
+  bool ok = !ferror(fp);
+  return fclose(fp) == 0 && ok;
+}
+
+int run_batch(const char *jobPath, const char *outPath, int threads, const run_options *options) {
+  int nJobs;
+  batch_job *jobs = load_jobs(jobPath, &nJobs);
+  if (jobs == NULL) return -1;
+
+  // runs of jobs on the same ROM go together for the lanes engine
+  int *groups = malloc((nJobs+1) * sizeof(int));
+  if (groups == NULL) {
+    printf("Out of memory\n");
+    free_jobs(jobs, nJobs);
+    return -1;
+  }
+  int nGroups = 0;
+  for (int i=0; i<nJobs; i++) {
+    bool join = options->engine == ENGINE_LANES && nGroups > 0
+      && i - groups[nGroups-1] < CHIP8_LANES
+      && strcmp(jobs[i].rom, jobs[groups[nGroups-1]].rom) == 0;
+    if (!join) groups[nGroups++] = i;
+  }
+  groups[nGroups] = nJobs;
+
+  if (threads <= 0) threads = cpu_count();
+  if (threads > nGroups) threads = nGroups > 0 ? nGroups : 1;
+
+  // the workers would all race to fill it in
+  chip8_decode_init();
+
+  batch_result *results = calloc(nJobs > 0 ? nJobs : 1, sizeof(batch_result));
+  batch_queue *queues = malloc(threads * sizeof(batch_queue));
+  batch_worker *workers = malloc(threads * sizeof(batch_worker));
+  pthread_t *tids = malloc(threads * sizeof(pthread_t));
+  if (results == NULL || queues == NULL || workers == NULL || tids == NULL) {
+    printf("Out of memory\n");
+    free(results);
+    free(queues);
+    free(workers);
+    free(tids);
+    free(groups);
+    free_jobs(jobs, nJobs);
+    return -1;
+  }
+
+  batch_pool pool = { jobs, groups, results, options, queues, threads };
+
+  // start everyone off with an equal share
+  for (int i=0; i<threads; i++) {
+    pthread_mutex_init(&queues[i].lock, NULL);
+    queues[i].next = (long)nGroups * i / threads;
+    queues[i].end = (long)nGroups * (i+1) / threads;
+    workers[i].pool = &pool;
+    workers[i].index = i;
+    workers[i].started = false;
+  }
+
+  double start = seconds_now();
+
+  for (int i=1; i<threads; i++) {
+    // a worker that didn't start just has its groups stolen by the others
+    workers[i].started = pthread_create(&tids[i], NULL, worker_main, &workers[i]) == 0;
+    if (!workers[i].started) {
+      fprintf(stderr, "Failed to start worker thread %d, the others will run its jobs\n", i);
+    }
+  }
+  // this thread is worker 0
+  worker_main(&workers[0]);
+  for (int i=1; i<threads; i++) {
+    if (workers[i].started) pthread_join(tids[i], NULL);
+  }
+
+  double seconds = seconds_now() - start;
+
+  int failed = 0, quit = 0;
+  uint64_t cycles = 0, idle = 0;
+  for (int i=0; i<nJobs; i++) {
+    cycles += results[i].cycles;
+    idle += results[i].idle_cycles;
+    if (results[i].status == BATCH_QUIT) quit++;
+    if (results[i].status == BATCH_ERROR) {
+      failed++;
+      fprintf(stderr, "%s:%d: %s\n", jobPath, jobs[i].line, results[i].error);
+    }
+  }
+
+  fprintf(stderr, "%d jobs on %d threads: %d ok, %d quit, %d errors\n",
+    nJobs, threads, nJobs - failed - quit, quit, failed);
+  // idle loops that were skipped didn't take any time, so they don't count
+  fprintf(stderr, "%llu instructions (%llu run, %llu skipped idle) in %.3f s",
+    (unsigned long long)cycles, (unsigned long long)(cycles - idle),
+    (unsigned long long)idle, seconds);
+  if (seconds > 0) {
+    fprintf(stderr, " (%.1f million instructions run per second)", (cycles - idle) / seconds / 1e6);
+  }
+  fputc('\n', stderr);
+
+  if (!write_results(outPath, results, nJobs)) {
+    printf("Failed to write results to '%s'\n", outPath);
+    failed = -1;
+  }
+
+  for (int i=0; i<nJobs; i++) {
+    free(results[i].error);
+  }
+  for (int i=0; i<threads; i++) {
+    pthread_mutex_destroy(&queues[i].lock);
+  }
+  free_jobs(jobs, nJobs);
+  free(groups);
+  free(results);
+  free(queues);
+  free(workers);
+  free(tids);
+
+  return failed;
+}
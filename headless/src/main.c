@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "run.h"
+#include "batch.h"
+
+void dump_state(chip8 *ch8) {
+  printf("PC=%03X I=%03X SP=%X DT=%02X ST=%02X\n", ch8->PC, ch8->I, ch8->SP, ch8->timer, ch8->sound);
+  for (int i=0; i<16; i++) {
+    printf("R%X=%02X%c", i, ch8->R[i], i % 8 == 7 ? '\n' : ' ');
+  }
+  for (int i=0; i<ch8->SP && i<CHIP8_STACK_SIZE; i++) {
+    printf("stack[%d]=%03X\n", i, ch8->stack[i]);
+  }
+
+  for (int y=0; y<CHIP8_SCREEN_H; y++) {
+    char row[CHIP8_SCREEN_W+1];
+    for (int x=0; x<CHIP8_SCREEN_W; x++) {
+      row[x] = chip8_get_pixel(ch8, x, y) ? '#' : '.';
+    }
+    row[CHIP8_SCREEN_W] = 0;
+    puts(row);
+  }
+}
+
+void usage(void) {
+  puts("Usage: ch8headless [options] <rom file>");
+  puts("       ch8headless [options] -b <job file> [-j <threads>] [-o <results file>]");
+  puts("  -p <profile>  default, cosmac, schip or xochip (guessed from the extension)");
+  puts("  -e <engine>   step, threaded, jit, or lanes for -b (the fastest that works)");
+  puts("  -c <n>        stop after n instructions");
+  puts("  -f <n>        stop after n frames (600 if neither -c nor -f is given)");
+  puts("  -i <n>        instructions per frame, between two timer ticks (1000)");
+  puts("  -s <n>        seed for the random numbers (a fixed one)");
+  puts("  -k <file>     key script, lines of '<frame> <held keys in hex, or ->'");
+  puts("  -r <file>     record the keys pressed into a movie");
+  puts("  -m <file>     play a movie back, until it ends (instead of -k)");
+  puts("  -d            dump the registers and screen at the end");
+  puts("  -H            print a hash of the final state");
+  puts("  -b <file>     run every '<rom> [key script]' line of a job file");
+  puts("  -j <n>        threads for -b (one per CPU)");
+  puts("  -o <file>     where -b writes its results (results.bin)");
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = NULL;
+  const char *profileName = NULL;
+  const char *engine = NULL;
+  const char *keyPath = NULL;
+  const char *recordPath = NULL;
+  const char *moviePath = NULL;
+  const char *jobPath = NULL;
+  const char *outPath = "results.bin";
+  int threads = 0;
+  bool dump = false, hash = false;
+
+  run_options options = {
+    .engine = ENGINE_BEST,
+    .profile = CHIP8_PROFILE_COUNT,
+    .max_cycles = UINT64_MAX,
+    .max_frames = UINT64_MAX,
+    .cycles_per_tick = CHIP8_DEFAULT_CYCLES_PER_TICK,
+    .seed = CHIP8_DEFAULT_SEED,
+  };
+
+  for (int i=1; i<argc; i++) {
+    const char *arg = argv[i];
+    bool hasValue = i+1 < argc;
+
+    if (strcmp(arg, "-p") == 0 && hasValue) profileName = argv[++i];
+    else if (strcmp(arg, "-e") == 0 && hasValue) engine = argv[++i];
+    else if (strcmp(arg, "-c") == 0 && hasValue) options.max_cycles = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(arg, "-f") == 0 && hasValue) options.max_frames = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(arg, "-i") == 0 && hasValue) options.cycles_per_tick = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(arg, "-s") == 0 && hasValue) options.seed = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(arg, "-k") == 0 && hasValue) keyPath = argv[++i];
+    else if (strcmp(arg, "-r") == 0 && hasValue) recordPath = argv[++i];
+    else if (strcmp(arg, "-m") == 0 && hasValue) moviePath = argv[++i];
+    else if (strcmp(arg, "-b") == 0 && hasValue) jobPath = argv[++i];
+    else if (strcmp(arg, "-j") == 0 && hasValue) threads = atoi(argv[++i]);
+    else if (strcmp(arg, "-o") == 0 && hasValue) outPath = argv[++i];
+    else if (strcmp(arg, "-d") == 0) dump = true;
+    else if (strcmp(arg, "-H") == 0) hash = true;
+    else if (arg[0] != '-' && path == NULL) path = arg;
+    else {
+      usage();
+      return 1;
+    }
+  }
+
+  if ((path == NULL) == (jobPath == NULL) || options.cycles_per_tick == 0
+      || (moviePath != NULL && (keyPath != NULL || recordPath != NULL))) {
+    usage();
+    return 1;
+  }
+
+  if (profileName != NULL) {
+    options.profile = chip8_profile_by_name(profileName);
+    if (options.profile == CHIP8_PROFILE_COUNT) {
+      printf("Unknown profile '%s'\n", profileName);
+      return 1;
+    }
+  }
+
+  if (engine != NULL) {
+    if (strcmp(engine, "step") == 0) options.engine = ENGINE_STEP;
+    else if (strcmp(engine, "threaded") == 0) options.engine = ENGINE_THREADED;
+    else if (strcmp(engine, "jit") == 0) options.engine = ENGINE_JIT;
+    else if (strcmp(engine, "lanes") == 0) options.engine = ENGINE_LANES;
+    else {
+      printf("Unknown engine '%s'\n", engine);
+      return 1;
+    }
+  }
+
+  // lanes run several jobs side by side, a single ROM has nothing to pair with
+  if (options.engine == ENGINE_LANES && jobPath == NULL) {
+    printf("The lanes engine only runs job files (-b)\n");
+    usage();
+    return 1;
+  }
+
+  if (jobPath != NULL) {
+    return run_batch(jobPath, outPath, threads, &options) == 0 ? 0 : 1;
+  }
+
+  int nEvents = 0;
+  key_event *events = NULL;
+  if (keyPath != NULL) {
+    char error[256];
+    events = load_key_script(keyPath, &nEvents, error);
+    if (events == NULL) {
+      printf("%s\n", error);
+      return 1;
+    }
+  }
+
+  chip8 ch8;
+  if (!run_setup(&ch8, path, &options)) {
+    printf("%s\n", ch8.errormsg);
+    free(events);
+    chip8_quit(&ch8);
+    return 1;
+  }
+
+  chip8_movie movie = {0};
+  if (moviePath != NULL) {
+    if (!chip8_movie_load(&movie, moviePath)) {
+      printf("Failed to read movie '%s'\n", moviePath);
+      chip8_quit(&ch8);
+      return 1;
+    }
+    if (!chip8_movie_play_start(&movie, &ch8)) {
+      printf("Movie '%s' was recorded with a different ROM\n", moviePath);
+      chip8_movie_free(&movie);
+      chip8_quit(&ch8);
+      return 1;
+    }
+  } else if (recordPath != NULL && !chip8_movie_record_start(&movie, &ch8)) {
+    printf("Out of memory\n");
+    free(events);
+    chip8_quit(&ch8);
+    return 1;
+  }
+
+  clock_t start = clock();
+  if (moviePath != NULL) {
+    run_movie(&ch8, &options, &movie);
+  } else {
+    run_frames(&ch8, &options, events, nEvents, recordPath != NULL ? &movie : NULL);
+  }
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  if (dump) dump_state(&ch8);
+  if (hash) printf("%016llX\n", (unsigned long long)chip8_hash(&ch8));
+
+  // idle loops that were skipped didn't take any time, so they don't count
+  uint64_t ran = ch8.cycles - ch8.idle_cycles;
+  fprintf(stderr, "%llu instructions (%llu run, %llu skipped idle), %llu frames in %.3f s",
+    (unsigned long long)ch8.cycles, (unsigned long long)ran,
+    (unsigned long long)ch8.idle_cycles, (unsigned long long)ch8.ticks, seconds);
+  if (seconds > 0) {
+    fprintf(stderr, " (%.1f million instructions run per second)", ran / seconds / 1e6);
+  }
+  fputc('\n', stderr);
+
+  int status = 0;
+  if (ch8.waserror) {
+    printf("CHIP-8 ERROR: %s\n", ch8.errormsg);
+    status = 1;
+  }
+
+  if (recordPath != NULL && !chip8_movie_save(&movie, recordPath)) {
+    printf("Failed to write movie '%s'\n", recordPath);
+    status = 1;
+  }
+
+  chip8_movie_free(&movie);
+  free(events);
+  chip8_quit(&ch8);
+  return status;
+}
@@ -0,0 +1,210 @@
+#include "run.h"
+#include "threaded.h"
+#include "jit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+byte *load_rom_from_file(const char *path, long *len) {
+
+  FILE *fp = fopen(path, "rb");
+
+  if (fp == NULL) {
+    *len = 0;
+    return NULL;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  long length = ftell(fp);
+  rewind(fp);
+
+  byte *buffer = malloc(length);
+
+  if (buffer == NULL) {
+    fclose(fp);
+    *len = 0;
+    return NULL;
+  }
+
+  size_t result = fread(buffer, sizeof(byte), (size_t)length, fp);
+
+  if (result != length) {
+    free(buffer);
+    fclose(fp);
+    *len = 0;
+    return NULL;
+  }
+
+  fclose(fp);
+
+  *len = length;
+
+  return buffer;
+}
+
+key_event *load_key_script(const char *path, int *count, char *error) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    snprintf(error, 256, "Failed to read key script '%s'", path);
+    return NULL;
+  }
+
+  int n = 0, capacity = 64;
+  key_event *events = malloc(capacity * sizeof(key_event));
+  if (events == NULL) {
+    snprintf(error, 256, "Out of memory reading key script '%s'", path);
+    fclose(fp);
+    return NULL;
+  }
+
+  char line[256];
+  int lineno = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    lineno++;
+    if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+
+    unsigned long long frame;
+    char keys[32];
+    if (sscanf(line, "%llu %31s", &frame, keys) != 2) {
+      snprintf(error, 256, "%s:%d: expected '<frame> <keys>'", path, lineno);
+      free(events);
+      fclose(fp);
+      return NULL;
+    }
+
+    if (n > 0 && frame < events[n-1].frame) {
+      snprintf(error, 256, "%s:%d: frames must be in order", path, lineno);
+      free(events);
+      fclose(fp);
+      return NULL;
+    }
+
+    if (n == capacity) {
+      key_event *bigger = realloc(events, capacity * 2 * sizeof(key_event));
+      if (bigger == NULL) {
+        snprintf(error, 256, "Out of memory reading key script '%s'", path);
+        free(events);
+        fclose(fp);
+        return NULL;
+      }
+      events = bigger;
+      capacity *= 2;
+    }
+
+    key_event *ev = &events[n++];
+    ev->frame = frame;
+    memset(ev->keys, 0, sizeof(ev->keys));
+    if (strcmp(keys, "-") != 0) {
+      for (const char *c = keys; *c; c++) {
+        char digit[2] = { *c, 0 };
+        char *end;
+        long key = strtol(digit, &end, 16);
+        if (*end != 0) {
+          snprintf(error, 256, "%s:%d: '%c' is not a key", path, lineno, *c);
+          free(events);
+          fclose(fp);
+          return NULL;
+        }
+        ev->keys[key] = true;
+      }
+    }
+  }
+
+  fclose(fp);
+  *count = n;
+  return events;
+}
+
+bool run_setup(chip8 *ch8, const char *path, const run_options *options) {
+  chip8_init(ch8);
+
+  long length;
+  byte *rom = load_rom_from_file(path, &length);
+  if (rom == NULL) {
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Failed to read ROM '%s'", path);
+    chip8_error(ch8, msg);
+    return false;
+  }
+
+  bool loaded = chip8_loadrom(ch8, rom, length);
+  free(rom);
+  if (!loaded) return false;
+
+  chip8_profile profile = options->profile;
+  if (profile == CHIP8_PROFILE_COUNT) {
+    profile = chip8_guess_profile(path);
+  }
+  chip8_set_profile(ch8, profile);
+  chip8_set_cycles_per_tick(ch8, options->cycles_per_tick);
+  chip8_seed(ch8, options->seed);
+
+  switch (options->engine) {
+    case ENGINE_BEST: {
+      if (!chip8_jit_enable(ch8)) {
+        chip8_threaded_enable(ch8);
+      }
+      break;
+    }
+
+    case ENGINE_JIT: {
+      if (!chip8_jit_enable(ch8)) {
+        chip8_error(ch8, "The recompiler isn't available here");
+        return false;
+      }
+      break;
+    }
+
+    case ENGINE_THREADED: {
+      chip8_threaded_enable(ch8);
+      break;
+    }
+
+    case ENGINE_STEP:
+    case ENGINE_LANES: {
+      break;
+    }
+  }
+
+  return true;
+}
+
+void run_frames(chip8 *ch8, const run_options *options, const key_event *events, int nEvents, chip8_movie *record) {
+  uint64_t max_cycles = options->max_cycles;
+  uint64_t max_frames = options->max_frames;
+  if (max_cycles == UINT64_MAX && max_frames == UINT64_MAX) {
+    max_frames = DEFAULT_FRAMES;
+  }
+
+  int nextEvent = 0;
+  while (!ch8->quit && ch8->ticks < max_frames && ch8->cycles < max_cycles) {
+    while (nextEvent < nEvents && events[nextEvent].frame <= ch8->ticks) {
+      memcpy(ch8->keys, events[nextEvent].keys, sizeof(ch8->keys));
+      nextEvent++;
+    }
+    if (record != NULL) chip8_movie_record(record, ch8, chip8_get_keys(ch8));
+
+    // one frame, up to the next timer tick
+    uint64_t tick = ch8->ticks;
+    while (!ch8->quit && ch8->ticks == tick && ch8->cycles < max_cycles) {
+      uint32_t budget = chip8_cycles_until_tick(ch8);
+      if (budget > max_cycles - ch8->cycles) budget = max_cycles - ch8->cycles;
+      chip8_run(ch8, budget);
+    }
+  }
+
+  if (record != NULL) chip8_movie_record_stop(record, ch8);
+}
+
+void run_movie(chip8 *ch8, const run_options *options, chip8_movie *movie) {
+  uint64_t max_cycles = options->max_cycles;
+  uint64_t max_frames = options->max_frames;
+
+  while (!ch8->quit && ch8->ticks < max_frames && ch8->cycles < max_cycles
+         && chip8_movie_play(movie, ch8)) {
+    uint32_t budget = chip8_cycles_until_tick(ch8);
+    if (budget > max_cycles - ch8->cycles) budget = max_cycles - ch8->cycles;
+    chip8_run(ch8, chip8_movie_cycles_until_event(movie, ch8, budget));
+  }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "flow.h"
+#include "quirks.h"
+
+// Writes the C file: the ROM image, one function per basic block,
+// and the chip8_aot_blocks table that chip8_aot_run dispatches on.
+// The quirks of `profile` are compiled into the blocks.
+void EmitC(FILE *fp, const FlowGraph *fg, const char *romName, chip8_profile profile);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "chip8.h"
+
+// Longest straight-line run turned into one C function
+#define FLOW_MAX_BLOCK_LENGTH 32
+
+typedef struct {
+  // the ROM, loaded where the emulator would put it
+  byte mem[CHIP8_MEM_SIZE];
+  // first address past the end of the ROM
+  word end;
+
+  // a basic block starts here
+  bool leader[CHIP8_MEM_SIZE];
+  // reached as (the first byte of) an instruction
+  bool code[CHIP8_MEM_SIZE];
+} FlowGraph;
+
+// Follows every jump, call and skip from the start address.
+// Computed jumps (BNNN) mark their whole possible range as reachable.
+bool AnalyzeFlow(FlowGraph *fg, const byte *rom, long length);
+
+// Does this instruction have to be the last one of a block?
+bool EndsBlock(byte op);
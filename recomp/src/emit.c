@@ -0,0 +1,157 @@
+#include "emit.h"
+#include "decode.h"
+
+#include <ctype.h>
+
+static const char *OP_NAMES[CHIP8_OP_COUNT] = {
+  [CHIP8_OP_INVALID] = "INVALID",
+  [CHIP8_OP_BREAK] = "BREAK",
+  [CHIP8_OP_CLEAR] = "CLEAR",
+  [CHIP8_OP_RETURN] = "RETURN",
+  [CHIP8_OP_JUMP] = "JUMP",
+  [CHIP8_OP_SUBROUTINE] = "SUBROUTINE",
+  [CHIP8_OP_IFNEQ] = "IFNEQ",
+  [CHIP8_OP_IFEQ] = "IFEQ",
+  [CHIP8_OP_IFNEQ_R] = "IFNEQ_R",
+  [CHIP8_OP_PIXEL] = "PIXEL",
+  [CHIP8_OP_SET] = "SET",
+  [CHIP8_OP_ADD] = "ADD",
+  [CHIP8_OP_SET_R] = "SET_R",
+  [CHIP8_OP_OR] = "OR",
+  [CHIP8_OP_AND] = "AND",
+  [CHIP8_OP_XOR] = "XOR",
+  [CHIP8_OP_ADD_R] = "ADD_R",
+  [CHIP8_OP_SUB] = "SUB",
+  [CHIP8_OP_RSHIFT] = "RSHIFT",
+  [CHIP8_OP_REVSUB] = "REVSUB",
+  [CHIP8_OP_LSHIFT] = "LSHIFT",
+  [CHIP8_OP_IFEQ_R] = "IFEQ_R",
+  [CHIP8_OP_SET_I] = "SET_I",
+  [CHIP8_OP_JUMP_R0] = "JUMP_R0",
+  [CHIP8_OP_RANDOM] = "RANDOM",
+  [CHIP8_OP_DRAW] = "DRAW",
+  [CHIP8_OP_IFNKEY] = "IFNKEY",
+  [CHIP8_OP_IFKEY] = "IFKEY",
+  [CHIP8_OP_GET_TIMER] = "GET_TIMER",
+  [CHIP8_OP_AWAIT] = "AWAIT",
+  [CHIP8_OP_SET_TIMER] = "SET_TIMER",
+  [CHIP8_OP_SET_SOUND] = "SET_SOUND",
+  [CHIP8_OP_ADD_I] = "ADD_I",
+  [CHIP8_OP_SETSPRITE] = "SETSPRITE",
+  [CHIP8_OP_BCD] = "BCD",
+  [CHIP8_OP_DUMP] = "DUMP",
+  [CHIP8_OP_FILL] = "FILL",
+};
+
+// CHIP8_OP_ADD_R -> chip8_op_add_r
+static void EmitHandlerName(FILE *fp, byte op) {
+  fputs("chip8_op_", fp);
+  for (const char *c = OP_NAMES[op]; *c; c++) {
+    fputc(tolower(*c), fp);
+  }
+}
+
+// the handlers that take a quirks argument
+static bool HasQuirks(byte op) {
+  switch (op) {
+    case CHIP8_OP_RSHIFT:
+    case CHIP8_OP_LSHIFT:
+    case CHIP8_OP_JUMP_R0:
+    case CHIP8_OP_DRAW:
+    case CHIP8_OP_DUMP:
+    case CHIP8_OP_FILL:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// "cosmac" -> COSMAC, for CHIP8_PROFILE_COSMAC and CHIP8_QUIRKS_COSMAC
+static void EmitProfileName(FILE *fp, chip8_profile profile) {
+  for (const char *c = chip8_profile_names[profile]; *c; c++) {
+    fputc(toupper(*c), fp);
+  }
+}
+
+// Returns the number of instructions in the block starting at addr
+static int BlockLength(const FlowGraph *fg, word start) {
+  int len = 0;
+  for (word addr=start; addr+1 < fg->end; addr+=2) {
+    if (addr != start && fg->leader[addr]) break;
+
+    len++;
+    byte op = chip8_decode((fg->mem[addr] << 8) | fg->mem[addr+1]).op;
+    if (EndsBlock(op) || len == FLOW_MAX_BLOCK_LENGTH) break;
+  }
+  return len;
+}
+
+static void EmitBlock(FILE *fp, const FlowGraph *fg, word start, int len) {
+  fprintf(fp, "static void block_%03X(chip8 *ch8) {\n", start);
+
+  for (int i=0; i<len; i++) {
+    word addr = start + i*2;
+    word w = (fg->mem[addr] << 8) | fg->mem[addr+1];
+    chip8_instr in = chip8_decode(w);
+
+    fprintf(fp, "  // %03X: %04X %s\n", addr, w, OP_NAMES[in.op]);
+    if (HasQuirks(in.op)) {
+      fputs("  CHIP8_AOT_QUIRK_OP(", fp);
+      EmitHandlerName(fp, in.op);
+      fputs(", QUIRKS", fp);
+    } else {
+      fputs("  CHIP8_AOT_OP(", fp);
+      EmitHandlerName(fp, in.op);
+    }
+    fprintf(fp, ", CHIP8_OP_%s, 0x%X, 0x%X, 0x%X, 0x%02X, 0x%03X);\n",
+      OP_NAMES[in.op], in.x, in.y, in.n, in.nn, in.nnn);
+  }
+
+  fputs("}\n\n", fp);
+}
+
+void EmitC(FILE *fp, const FlowGraph *fg, const char *romName, chip8_profile profile) {
+  long length = fg->end - CHIP8_PROGRAM_START_ADDRESS;
+
+  fprintf(fp, "// Generated by ch8recomp from '%s', do not edit.\n", romName);
+  fputs("// Build it into the emulator with -DCHIP8_AOT.\n\n", fp);
+  fputs("#include \"aot.h\"\n#include \"ops.h\"\n\n", fp);
+
+  fputs("#define QUIRKS CHIP8_QUIRKS_", fp);
+  EmitProfileName(fp, profile);
+  fputs("\nconst chip8_profile chip8_aot_profile = CHIP8_PROFILE_", fp);
+  EmitProfileName(fp, profile);
+  fputs(";\n\n", fp);
+
+  fprintf(fp, "const long chip8_aot_rom_length = %ld;\n\n", length);
+  fputs("const byte chip8_aot_rom[] = {", fp);
+  for (long i=0; i<length; i++) {
+    if (i % 12 == 0) fputs("\n ", fp);
+    fprintf(fp, " 0x%02X,", fg->mem[CHIP8_PROGRAM_START_ADDRESS+i]);
+  }
+  // an empty initializer isn't valid C, so an empty ROM gets a byte
+  // that chip8_aot_rom_length leaves out
+  if (length == 0) fputs("\n  0x00,", fp);
+  fputs("\n};\n\n", fp);
+
+  static int lengths[CHIP8_MEM_SIZE];
+  for (int addr=0; addr<CHIP8_MEM_SIZE; addr++) {
+    lengths[addr] = fg->leader[addr] ? BlockLength(fg, addr) : 0;
+    if (lengths[addr] > 0) {
+      EmitBlock(fp, fg, addr, lengths[addr]);
+    }
+  }
+
+  fputs("const chip8_aot_block chip8_aot_blocks[CHIP8_MEM_SIZE] = {\n", fp);
+  int nBlocks = 0;
+  for (int addr=0; addr<CHIP8_MEM_SIZE; addr++) {
+    if (lengths[addr] > 0) {
+      fprintf(fp, "  [0x%03X] = { block_%03X, %d },\n", addr, addr, lengths[addr]);
+      nBlocks++;
+    }
+  }
+  // same again, with no blocks at all
+  if (nBlocks == 0) fputs("  { NULL, 0 },\n", fp);
+  fputs("};\n", fp);
+}
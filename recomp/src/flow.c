@@ -0,0 +1,128 @@
+#include "flow.h"
+#include "decode.h"
+
+#include <string.h>
+
+// every address can be pushed at most once as a new leader
+#define WORKLIST_SIZE CHIP8_MEM_SIZE
+
+static word worklist[WORKLIST_SIZE];
+static int nWork = 0;
+
+static void Push(FlowGraph *fg, word addr) {
+  if (addr+1 >= fg->end || addr < CHIP8_PROGRAM_START_ADDRESS) return;
+  if (fg->leader[addr]) return;
+
+  fg->leader[addr] = true;
+  worklist[nWork++] = addr;
+}
+
+bool EndsBlock(byte op) {
+  switch (op) {
+    // control flow
+    case CHIP8_OP_JUMP:
+    case CHIP8_OP_SUBROUTINE:
+    case CHIP8_OP_RETURN:
+    case CHIP8_OP_JUMP_R0:
+    case CHIP8_OP_IFNEQ:
+    case CHIP8_OP_IFEQ:
+    case CHIP8_OP_IFNEQ_R:
+    case CHIP8_OP_IFEQ_R:
+    case CHIP8_OP_IFNKEY:
+    case CHIP8_OP_IFKEY:
+    // can stop the machine
+    case CHIP8_OP_INVALID:
+    case CHIP8_OP_BREAK:
+    // chip8_run returns after these
+    case CHIP8_OP_CLEAR:
+    case CHIP8_OP_PIXEL:
+    case CHIP8_OP_DRAW:
+    case CHIP8_OP_AWAIT:
+    // can write to memory, maybe to code
+    case CHIP8_OP_BCD:
+    case CHIP8_OP_DUMP:
+    case CHIP8_OP_FILL:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+bool AnalyzeFlow(FlowGraph *fg, const byte *rom, long length) {
+  if (length > CHIP8_MAX_PROGRAM_SIZE) return false;
+
+  memset(fg, 0, sizeof(FlowGraph));
+  memcpy(fg->mem+CHIP8_PROGRAM_START_ADDRESS, rom, length);
+  fg->end = CHIP8_PROGRAM_START_ADDRESS + length;
+
+  nWork = 0;
+  Push(fg, CHIP8_PROGRAM_START_ADDRESS);
+
+  while (nWork > 0) {
+    word start = worklist[--nWork];
+    int len = 0;
+
+    for (word addr=start; addr+1 < fg->end; addr+=2) {
+      // somebody already walked on from here
+      if (addr != start && fg->code[addr]) break;
+      fg->code[addr] = true;
+
+      chip8_instr in = chip8_decode((fg->mem[addr] << 8) | fg->mem[addr+1]);
+
+      switch (in.op) {
+        case CHIP8_OP_JUMP: {
+          Push(fg, in.nnn);
+          break;
+        }
+
+        case CHIP8_OP_SUBROUTINE: {
+          Push(fg, in.nnn);
+          Push(fg, addr+2);
+          break;
+        }
+
+        case CHIP8_OP_JUMP_R0: {
+          // NNN + R0, R0 could be anything
+          for (int i=0; i<256; i+=2) {
+            Push(fg, in.nnn + i);
+          }
+          break;
+        }
+
+        case CHIP8_OP_IFNEQ:
+        case CHIP8_OP_IFEQ:
+        case CHIP8_OP_IFNEQ_R:
+        case CHIP8_OP_IFEQ_R:
+        case CHIP8_OP_IFNKEY:
+        case CHIP8_OP_IFKEY: {
+          Push(fg, addr+2);
+          Push(fg, addr+4);
+          break;
+        }
+
+        case CHIP8_OP_RETURN:
+        case CHIP8_OP_INVALID:
+        case CHIP8_OP_BREAK: {
+          break;
+        }
+
+        default: {
+          // the rest carry on to the next instruction
+          if (EndsBlock(in.op)) Push(fg, addr+2);
+          break;
+        }
+      }
+
+      if (EndsBlock(in.op)) break;
+
+      // too long, start a new block after this one
+      if (++len == FLOW_MAX_BLOCK_LENGTH) {
+        Push(fg, addr+2);
+        break;
+      }
+    }
+  }
+
+  return true;
+}
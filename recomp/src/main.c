@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "flow.h"
+#include "emit.h"
+#include "quirks.h"
+
+#include <string.h>
+
+byte *ReadFile(const char *path, long *length) {
+  byte *buffer = NULL;
+  FILE *f = fopen(path, "rb");
+
+  if (f) {
+    fseek(f, 0, SEEK_END);
+    *length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    // at least a byte, so an empty file isn't mistaken for running out of memory
+    buffer = *length >= 0 ? malloc(*length > 0 ? *length : 1) : NULL;
+    if (buffer && fread(buffer, 1, *length, f) != (size_t)*length) {
+      // a short read would recompile whatever was in the buffer
+      free(buffer);
+      buffer = NULL;
+    }
+    fclose(f);
+  }
+  return buffer;
+}
+
+int main(int argc, char *argv[]) {
+
+  puts("CHIP-8 RECOMPILER");
+
+  // -p <profile> overrides the guess from the file extension
+  const char *profileName = NULL;
+  if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+    profileName = argv[2];
+    argv += 2;
+    argc -= 2;
+  }
+
+  if (argc < 2) {
+    puts("Usage: ch8recomp [-p default|cosmac|schip|xochip] <rom file> [output file]");
+    return 0;
+  }
+
+  const char *outPath = "out.c";
+  if (argc > 2) {
+    outPath = argv[2];
+  }
+
+  chip8_profile profile = chip8_guess_profile(argv[1]);
+  if (profileName != NULL) {
+    profile = chip8_profile_by_name(profileName);
+    if (profile == CHIP8_PROFILE_COUNT) {
+      printf("Unknown profile '%s'\n", profileName);
+      return 1;
+    }
+  }
+
+  printf("\nRECOMPILING '%s' (%s)\n", argv[1], chip8_profile_names[profile]);
+
+  long length;
+  byte *rom = ReadFile(argv[1], &length);
+  if (rom == NULL) {
+    printf("Failed to read file '%s'\n", argv[1]);
+    return 1;
+  }
+
+  static FlowGraph fg;
+  if (!AnalyzeFlow(&fg, rom, length)) {
+    printf("\n[!] ROM IS TOO BIG (%ld bytes, max %d)\n", length, CHIP8_MAX_PROGRAM_SIZE);
+    free(rom);
+    return 1;
+  }
+  free(rom);
+
+  int nBlocks = 0, nInstructions = 0;
+  for (int i=0; i<CHIP8_MEM_SIZE; i++) {
+    if (fg.leader[i]) nBlocks++;
+    if (fg.code[i]) nInstructions++;
+  }
+  printf("Found %d instructions in %d blocks\n", nInstructions, nBlocks);
+
+  FILE *fp = fopen(outPath, "w");
+  if (fp == NULL) {
+    printf("Failed to open output file '%s'\n", outPath);
+    return 1;
+  }
+
+  EmitC(fp, &fg, argv[1], profile);
+  fclose(fp);
+
+  printf("\nWrote '%s'\n", outPath);
+  return 0;
+}